@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "admit.h"
+
+#define ADMIT_WAYS 4
+
+typedef struct {
+    uint64_t key_hi;
+    uint64_t key_lo;
+    uint64_t last_us;       // 0 marks an unused entry
+    double tokens;
+} admit_slot_t;
+
+struct admit_s {
+    double rate;
+    double burst;
+    double ip_rate;
+    double ip_burst;
+    double tokens;
+    uint64_t last_us;
+    uint32_t nsets;
+    admit_slot_t *slots;
+};
+
+admit_t *
+admit_create(double rate, double burst, double ip_rate, double ip_burst, uint32_t slots) {
+    admit_t *a = calloc(1, sizeof(admit_t));
+    if (a == NULL)
+        return NULL;
+    a->rate = rate;
+    a->burst = burst > 1 ? burst : 1;
+    a->ip_rate = ip_rate;
+    a->ip_burst = ip_burst > 1 ? ip_burst : 1;
+    a->tokens = a->burst;
+    uint32_t nsets = 1;
+    while (nsets * ADMIT_WAYS < slots)
+        nsets <<= 1;
+    a->nsets = nsets;
+    a->slots = calloc((size_t)nsets * ADMIT_WAYS, sizeof(admit_slot_t));
+    if (a->slots == NULL) {
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+void
+admit_free(admit_t *a) {
+    free(a->slots);
+    free(a);
+}
+
+static void
+refill(double *tokens, uint64_t *last_us, double rate, double burst, uint64_t now_us) {
+    if (*last_us && now_us > *last_us) {
+        *tokens += (double)(now_us - *last_us) * rate / 1000000.0;
+        if (*tokens > burst)
+            *tokens = burst;
+    }
+    *last_us = now_us;
+}
+
+// NULL for anything that isn't an ip address
+static admit_slot_t *
+source_slot(admit_t *a, const struct sockaddr_storage *sa, uint64_t now_us) {
+    uint64_t hi, lo;
+    const struct in6_addr *a6 = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+    if (sa->ss_family == AF_INET) {
+        hi = 0;
+        lo = ((const struct sockaddr_in *)sa)->sin_addr.s_addr;
+    } else if (sa->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(a6)) {
+        // a v4 client of a dual stack listener, the same key as over AF_INET
+        hi = 0;
+        lo = a6->s6_addr32[3];
+    } else if (sa->ss_family == AF_INET6) {
+        // one v6 host usually owns a whole /64
+        memcpy(&hi, a6->s6_addr, 8);
+        lo = 1;
+    } else {
+        return NULL;
+    }
+    uint64_t h = (hi ^ (lo * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    admit_slot_t *set = a->slots + (size_t)((h >> 32) & (a->nsets - 1)) * ADMIT_WAYS;
+    admit_slot_t *victim = set;
+    for (int i = 0; i < ADMIT_WAYS; i++) {
+        admit_slot_t *s = set + i;
+        if (s->last_us && s->key_hi == hi && s->key_lo == lo)
+            return s;
+        if (s->last_us < victim->last_us)
+            victim = s;
+    }
+    victim->key_hi = hi;
+    victim->key_lo = lo;
+    victim->tokens = a->ip_burst;
+    victim->last_us = now_us;
+    return victim;
+}
+
+int
+admit_check(admit_t *a, const struct sockaddr_storage *sa, uint64_t now_us) {
+    admit_slot_t *slot = NULL;
+    if (a->ip_rate > 0 && (slot = source_slot(a, sa, now_us)) != NULL) {
+        refill(&slot->tokens, &slot->last_us, a->ip_rate, a->ip_burst, now_us);
+        if (slot->tokens < 1)
+            return ADMIT_REJECT_IP;
+    }
+    if (a->rate > 0) {
+        refill(&a->tokens, &a->last_us, a->rate, a->burst, now_us);
+        if (a->tokens < 1)
+            return ADMIT_REJECT_RATE;
+        a->tokens -= 1;
+    }
+    if (slot)
+        slot->tokens -= 1;
+    return ADMIT_OK;
+}
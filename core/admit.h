@@ -0,0 +1,24 @@
+#ifndef admit_h
+#define admit_h
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Admission control for accepted connections: a global token bucket plus
+// one bucket per source address (v4 address or v6 /64, a v4-mapped v6 address
+// counts as its v4 one) in a fixed 4-way set associative table, the least
+// recently used entry of a set is reused.
+typedef struct admit_s admit_t;
+
+#define ADMIT_OK 0
+#define ADMIT_REJECT_RATE 1     // the global bucket is empty
+#define ADMIT_REJECT_IP 2       // the bucket of this source is empty
+
+// rate: tokens per second, burst: bucket size, rate <= 0 disables a bucket.
+// slots: per source entries, rounded up to a power of two
+admit_t *admit_create(double rate, double burst, double ip_rate, double ip_burst, uint32_t slots);
+void admit_free(admit_t *a);
+
+// takes one token from both buckets or none, now in usec of a monotonic clock
+int admit_check(admit_t *a, const struct sockaddr_storage *sa, uint64_t now_us);
+
+#endif
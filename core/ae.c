@@ -1,7 +1,7 @@
 #include "ae.h"
+#include "anet.h"
 #include "poll.h"
 #include <unistd.h>
-#include <sys/epoll.h>
 
 const char * socket_error(int fd) {
     int error;
@@ -18,6 +18,964 @@ const char * socket_error(int fd) {
     return err;
 }
 
+#ifdef AE_USE_IO_URING
+/*
+ * io_uring backend. Every registration change is queued as an SQE and
+ * submitted together with the wait in one io_uring_enter, instead of one
+ * epoll_ctl syscall each.
+ *
+ * Connected stream sockets are completion based: a multishot recv fills
+ * buffers of a provided buffer ring and ae_readv copies out of them, writes
+ * are copied into a per socket send block by ae_writev and submitted as
+ * one send SQE per socket with the next ae_poll. Readiness of these sockets
+ * is derived from the queues (data or eof queued, send room left), so
+ * ae_poll keeps the level/edge-triggered contract of the epoll backend.
+ *
+ * Other fds (listeners, udp, pipes, sockets still connecting) are polled:
+ * level-triggered ones with one-shot polls that are re-armed on the next
+ * ae_poll (a still-ready fd completes again immediately), edge-triggered
+ * ones with a multishot poll. Without provided buffer rings (before linux
+ * 5.19) every fd is polled.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define AE_URING_ENTRIES 1024
+#define AE_URING_CQ_ENTRIES 8192
+#define AE_URING_BUFS 1024          // provided recv buffers, a power of two
+#define AE_URING_BUF_SIZE 4096
+#define AE_URING_BGID 0
+#define AE_URING_SEND_MAX 65536     // queued send bytes before a write sees EAGAIN
+
+// the low two bits of user_data tell the requests apart
+#define AE_URING_POLL 0
+#define AE_URING_RECV 1
+#define AE_URING_SEND 2             // user_data is the ae_send_t
+#define AE_URING_UD_IGNORE UINT64_MAX
+
+// bytes of one send request, the block in flight never moves
+typedef struct ae_send_s {
+    struct ae_send_s *next;     // goes out after this one, only on a deleted socket
+    int fd;                     // owner, -1 once the socket was deleted
+    int sock;                   // fd the send goes to
+    int own_sock;               // sock is a dup that keeps a deleted socket open
+    uint32_t off;               // bytes already sent
+    uint32_t len;
+    uint32_t cap;
+    char data[];
+} ae_send_t;
+
+typedef struct {
+    uint32_t gen;       // bumped on every disarm, stale completions are dropped
+    uint8_t added;
+    uint8_t mask;       // AE_READABLE | AE_WRITABLE
+    uint8_t et;         // multishot poll, or edges only for a recv socket
+    uint8_t armed;      // a poll or recv request is live in the kernel
+    uint8_t pending;    // on the re-arm list
+    uint8_t recv;       // a connected stream socket read by multishot recv
+    uint8_t probed;     // the socket type was checked
+    uint8_t canceling;  // the live recv was asked to stop
+    uint8_t eof;
+    uint8_t edge;       // AE_READABLE | AE_WRITABLE seen since the last report
+    uint8_t wblocked;   // a write saw EAGAIN
+    uint8_t inready;    // on the ready list
+    uint8_t insend;     // on the send list
+    int err;            // errno of a failed recv or send, reported by ae_readv/ae_writev
+    uint32_t rbytes;    // bytes queued in recv buffers
+    uint32_t off;       // bytes of the head buffer already read
+    int head, tail;     // queued recv buffers, valid while rbytes > 0
+    uint32_t epoch;     // last ae_poll that reported the socket
+    ae_send_t *sending; // in flight
+    ae_send_t *queued;  // collects writes until the next submission
+} ae_fdstate_t;
+
+typedef struct {
+    int *fds;
+    int n, cap;
+} ae_fdlist_t;
+
+typedef struct ae_uring_s {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    unsigned sqe_tail;
+    ae_fdstate_t *fds;
+    int nfds;
+    ae_fdlist_t rearm;
+    ae_fdlist_t ready;          // recv sockets that may have something to report
+    ae_fdlist_t sendq;          // recv sockets with writes to submit
+    uint32_t epoch;
+    struct io_uring_buf_ring *br;   // NULL without provided buffer rings
+    char *bufs;
+    size_t br_sz;
+    uint16_t br_tail;
+    int bufs_held;              // buffers queued on sockets, not yet read
+    int *buf_next;
+    uint32_t *buf_len;
+    struct ae_uring_s *next;
+} ae_uring_t;
+
+// one ring per loop thread
+static __thread ae_uring_t *rings = NULL;
+
+static ae_uring_t *
+uring_get(int aefd) {
+    ae_uring_t *r;
+    for (r = rings; r; r = r->next) {
+        if (r->fd == aefd)
+            return r;
+    }
+    errno = EBADF;
+    return NULL;
+}
+
+// the ring serving fd with completions, NULL if it is a plain fd
+static ae_fdstate_t *
+uring_conn(int fd, ae_uring_t **pr) {
+    ae_uring_t *r;
+    for (r = rings; r; r = r->next) {
+        if (fd >= 0 && fd < r->nfds && r->fds[fd].added && r->fds[fd].recv) {
+            *pr = r;
+            return &r->fds[fd];
+        }
+    }
+    return NULL;
+}
+
+static ae_fdstate_t *
+uring_fdstate(ae_uring_t *r, int fd) {
+    if (fd < 0)
+        return NULL;
+    if (fd >= r->nfds) {
+        int n = r->nfds ? r->nfds : 1024;
+        while (n <= fd)
+            n <<= 1;
+        ae_fdstate_t *fds = realloc(r->fds, n * sizeof(ae_fdstate_t));
+        if (fds == NULL)
+            return NULL;
+        memset(fds + r->nfds, 0, (n - r->nfds) * sizeof(ae_fdstate_t));
+        r->fds = fds;
+        r->nfds = n;
+    }
+    return &r->fds[fd];
+}
+
+static int
+fdlist_push(ae_fdlist_t *l, int fd) {
+    if (l->n == l->cap) {
+        int n = l->cap ? l->cap * 2 : 256;
+        int *fds = realloc(l->fds, n * sizeof(int));
+        if (fds == NULL)
+            return 0;
+        l->fds = fds;
+        l->cap = n;
+    }
+    l->fds[l->n++] = fd;
+    return 1;
+}
+
+static inline uint64_t
+uring_ud(ae_fdstate_t *st, int fd, int kind) {
+    return ((uint64_t)st->gen << 32) | ((uint32_t)fd << 2) | kind;
+}
+
+static int
+uring_enter(ae_uring_t *r, unsigned min_complete, int timeout) {
+    unsigned flags = 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    if (min_complete) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    unsigned to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    int ret = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, argp, argsz);
+    if (ret < 0 && (errno == ETIME || errno == EINTR))
+        ret = 0;
+    return ret;
+}
+
+static struct io_uring_sqe *
+uring_sqe(ae_uring_t *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) {
+        uring_enter(r, 0, 0);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head >= r->sq_entries)
+            return NULL;
+    }
+    unsigned idx = r->sqe_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sqe_tail++;
+    return sqe;
+}
+
+static int
+uring_arm(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (sqe == NULL)
+        return 0;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = ((st->mask & AE_READABLE) ? POLLIN : 0) |
+        ((st->mask & AE_WRITABLE) ? POLLOUT : 0);
+    sqe->len = st->et ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = uring_ud(st, fd, AE_URING_POLL);
+    st->armed = 1;
+    return 1;
+}
+
+static int
+uring_arm_recv(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (sqe == NULL)
+        return 0;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = AE_URING_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = uring_ud(st, fd, AE_URING_RECV);
+    st->armed = 1;
+    st->canceling = 0;
+    return 1;
+}
+
+static void
+uring_cancel(ae_uring_t *r, uint64_t ud) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = ud;
+        sqe->user_data = AE_URING_UD_IGNORE;
+    }
+}
+
+static void
+uring_disarm(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    if (st->armed) {
+        struct io_uring_sqe *sqe = uring_sqe(r);
+        if (sqe) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = uring_ud(st, fd, AE_URING_POLL);
+            sqe->user_data = AE_URING_UD_IGNORE;
+        }
+        st->armed = 0;
+    }
+    st->gen++;
+}
+
+static int
+uring_queue_rearm(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    if (st->pending)
+        return 1;
+    if (!fdlist_push(&r->rearm, fd))
+        return 0;
+    st->pending = 1;
+    return 1;
+}
+
+static void
+uring_queue_ready(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    if (!st->inready && fdlist_push(&r->ready, fd))
+        st->inready = 1;
+}
+
+static void
+uring_flush_rearm(ae_uring_t *r) {
+    int keep = 0;
+    for (int i = 0; i < r->rearm.n; i++) {
+        int fd = r->rearm.fds[i];
+        ae_fdstate_t *st = &r->fds[fd];
+        if (!st->added || st->armed || !st->mask) {
+            st->pending = 0;
+        } else if (!st->recv) {
+            st->pending = 0;
+            uring_arm(r, fd, st);
+        } else if (!(st->mask & AE_READABLE) || st->eof || st->err) {
+            st->pending = 0;
+        } else if (r->bufs_held >= AE_URING_BUFS) {
+            // every buffer waits to be read, try again once one is back
+            r->rearm.fds[keep++] = fd;
+        } else {
+            st->pending = 0;
+            uring_arm_recv(r, fd, st);
+        }
+    }
+    r->rearm.n = keep;
+}
+
+static void
+uring_buf_put(ae_uring_t *r, int bid) {
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (AE_URING_BUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)bid * AE_URING_BUF_SIZE);
+    b->len = AE_URING_BUF_SIZE;
+    b->bid = bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+uring_setup_bufs(ae_uring_t *r) {
+    size_t ring_sz = AE_URING_BUFS * sizeof(struct io_uring_buf);
+    r->br_sz = ring_sz + (size_t)AE_URING_BUFS * AE_URING_BUF_SIZE;
+    // mapped rather than malloced, a recv still landing after ae_free faults
+    // harmlessly in the kernel instead of writing into reused heap
+    void *mem = mmap(NULL, r->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return -1;
+    r->buf_next = malloc(AE_URING_BUFS * sizeof(int));
+    r->buf_len = malloc(AE_URING_BUFS * sizeof(uint32_t));
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = AE_URING_BUFS;
+    reg.bgid = AE_URING_BGID;
+    if (r->buf_next == NULL || r->buf_len == NULL ||
+        syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(r->buf_next);
+        free(r->buf_len);
+        r->buf_next = NULL;
+        r->buf_len = NULL;
+        munmap(mem, r->br_sz);
+        return -1;
+    }
+    r->br = mem;
+    r->bufs = (char *)mem + ring_sz;
+    for (int i = 0; i < AE_URING_BUFS; i++)
+        uring_buf_put(r, i);
+    return 0;
+}
+
+// recv buffers left unread go back to the ring
+static void
+uring_drop_recv(ae_uring_t *r, ae_fdstate_t *st) {
+    int bid = st->head;
+    while (st->rbytes > 0) {
+        uint32_t left = r->buf_len[bid] - st->off;
+        st->rbytes -= left < st->rbytes ? left : st->rbytes;
+        st->off = 0;
+        int next = r->buf_next[bid];
+        r->bufs_held--;
+        uring_buf_put(r, bid);
+        bid = next;
+    }
+    st->off = 0;
+}
+
+static inline uint32_t
+uring_send_bytes(ae_fdstate_t *st) {
+    return (st->sending ? st->sending->len - st->sending->off : 0) +
+        (st->queued ? st->queued->len : 0);
+}
+
+static int
+uring_send(ae_uring_t *r, ae_send_t *s) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (sqe == NULL)
+        return 0;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->sock;
+    sqe->addr = (uint64_t)(uintptr_t)(s->data + s->off);
+    sqe->len = s->len - s->off;
+    // a stream socket completes the whole block, retrying partial sends in the kernel
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)s | AE_URING_SEND;
+    return 1;
+}
+
+// one send per socket in flight keeps the byte order, what was written
+// meanwhile goes out as one block when it completes
+static void
+uring_flush_sends(ae_uring_t *r) {
+    int keep = 0;
+    for (int i = 0; i < r->sendq.n; i++) {
+        int fd = r->sendq.fds[i];
+        ae_fdstate_t *st = &r->fds[fd];
+        ae_send_t *s = st->queued;
+        if (!st->added || !st->recv || st->sending || s == NULL || s->len == 0) {
+            st->insend = 0;
+            continue;
+        }
+        s->fd = s->sock = fd;
+        s->off = 0;
+        if (!uring_send(r, s)) {
+            r->sendq.fds[keep++] = fd;
+            continue;
+        }
+        st->insend = 0;
+        st->sending = s;
+        st->queued = NULL;
+    }
+    r->sendq.n = keep;
+}
+
+static void
+uring_free_sends(ae_send_t *s) {
+    while (s) {
+        ae_send_t *next = s->next;
+        if (s->own_sock)
+            close(s->sock);
+        free(s);
+        s = next;
+    }
+}
+
+// the socket is closed right after ae_del_event: a send in flight holds
+// its own reference and finishes, queued bytes are submitted now, after the
+// one in flight if there is one through a dup of the socket
+static void
+uring_orphan_sends(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    ae_send_t *q = st->queued;
+    st->queued = NULL;
+    if (q && q->len == 0) {
+        free(q);
+        q = NULL;
+    }
+    if (st->sending) {
+        st->sending->fd = -1;
+        if (q) {
+            q->fd = -1;
+            q->off = 0;
+            q->sock = dup(fd);
+            q->own_sock = q->sock >= 0;
+            if (q->own_sock)
+                st->sending->next = q;
+            else
+                free(q);
+        }
+        st->sending = NULL;
+    } else if (q) {
+        q->fd = -1;
+        q->sock = fd;
+        q->off = 0;
+        if (uring_send(r, q))
+            uring_enter(r, 0, 0);
+        else
+            free(q);
+    }
+}
+
+static void
+uring_send_done(ae_uring_t *r, ae_send_t *s, int res) {
+    if (res > 0)
+        s->off += res;
+    if (res > 0 && s->off < s->len && uring_send(r, s))
+        return;
+    if (s->fd < 0) {
+        ae_send_t *next = s->next;
+        s->next = NULL;
+        if (next && (res < 0 || !uring_send(r, next))) {
+            uring_free_sends(next);
+            next = NULL;
+        }
+        // the next block took over the dup
+        if (next == NULL && s->own_sock)
+            close(s->sock);
+        free(s);
+        return;
+    }
+    int fd = s->fd;
+    ae_fdstate_t *st = &r->fds[fd];
+    st->sending = NULL;
+    if (res < 0 && res != -ECANCELED && !st->err)
+        st->err = -res;
+    if (st->queued == NULL) {
+        s->len = s->off = 0;
+        st->queued = s;
+    } else {
+        free(s);
+    }
+    if (st->queued->len > 0 && !st->insend && fdlist_push(&r->sendq, fd))
+        st->insend = 1;
+    if (uring_send_bytes(st) < AE_URING_SEND_MAX) {
+        if (st->wblocked)
+            st->edge |= AE_WRITABLE;
+        st->wblocked = 0;
+        uring_queue_ready(r, fd, st);
+    }
+}
+
+static void
+uring_recv_done(ae_uring_t *r, struct io_uring_cqe *cqe, int fd, uint32_t gen) {
+    ae_fdstate_t *st = fd < r->nfds ? &r->fds[fd] : NULL;
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (st == NULL || !st->added || !st->recv || st->gen != gen) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            uring_buf_put(r, bid);
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        st->armed = 0;
+        st->canceling = 0;
+    }
+    int res = cqe->res;
+    if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        r->buf_len[bid] = res;
+        if (st->rbytes == 0)
+            st->head = bid;
+        else
+            r->buf_next[st->tail] = bid;
+        st->tail = bid;
+        st->rbytes += res;
+        r->bufs_held++;
+        st->edge |= AE_READABLE;
+    } else if (res == 0) {
+        st->eof = 1;
+        st->edge |= AE_READABLE;
+    } else if (res == -ENOTCONN || res == -EINVAL || res == -EOPNOTSUPP) {
+        // a listening socket, it gets polled like any other fd
+        if (st->rbytes == 0 && !st->eof && !st->sending && !st->queued) {
+            st->recv = 0;
+            uring_queue_rearm(r, fd, st);
+            return;
+        }
+        st->err = -res;
+        st->edge |= AE_READABLE;
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        st->err = -res;
+        st->edge |= AE_READABLE;
+    }
+    if (!st->armed)
+        uring_queue_rearm(r, fd, st);
+    uring_queue_ready(r, fd, st);
+}
+
+// reports the recv sockets of the ready list, level-triggered ones stay on it
+// while they have something to report. a socket is reported once per poll
+static int
+uring_fire_ready(ae_uring_t *r, event_t *fired, int n, int nfire) {
+    int keep = 0;
+    for (int i = 0; i < r->ready.n; i++) {
+        int fd = r->ready.fds[i];
+        ae_fdstate_t *st = &r->fds[fd];
+        if (!st->added || !st->recv) {
+            st->inready = 0;
+            continue;
+        }
+        int readable, writable;
+        if (st->et) {
+            readable = st->edge & AE_READABLE;
+            writable = st->edge & AE_WRITABLE;
+        } else {
+            readable = (st->mask & AE_READABLE) && (st->rbytes || st->eof || st->err);
+            writable = (st->mask & AE_WRITABLE) && uring_send_bytes(st) < AE_URING_SEND_MAX;
+        }
+        if (!readable && !writable) {
+            st->inready = 0;
+            continue;
+        }
+        if (n == nfire || st->epoch == r->epoch) {
+            r->ready.fds[keep++] = fd;
+            continue;
+        }
+        st->edge = 0;
+        st->epoch = r->epoch;
+        fired[n].fd = fd;
+        fired[n].read = readable != 0;
+        fired[n].write = writable != 0;
+        fired[n].error = false;
+        n++;
+        if (st->et)
+            st->inready = 0;
+        else
+            r->ready.fds[keep++] = fd;
+    }
+    r->ready.n = keep;
+    return n;
+}
+
+// connected stream sockets are read by multishot recv
+static void
+uring_probe(ae_uring_t *r, int fd, ae_fdstate_t *st) {
+    int type;
+    socklen_t len = sizeof(type);
+    st->probed = 1;
+    if (r->br && getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM) {
+        st->recv = 1;
+        st->eof = 0;
+        st->err = 0;
+        st->edge = 0;
+        st->wblocked = 0;
+        st->rbytes = 0;
+        st->off = 0;
+    }
+}
+
+static int
+uring_add(int aefd, int fd, int mask, int et) {
+    ae_uring_t *r = uring_get(aefd);
+    if (r == NULL)
+        return 0;
+    ae_fdstate_t *st = uring_fdstate(r, fd);
+    if (st == NULL)
+        return 0;
+    if (st->added) {
+        errno = EEXIST;
+        return 0;
+    }
+    st->added = 1;
+    st->mask = mask;
+    st->et = et;
+    st->armed = 0;
+    st->recv = 0;
+    st->probed = 0;
+    // a socket still connecting is probed once it is enabled for reading
+    if (mask & AE_READABLE)
+        uring_probe(r, fd, st);
+    return uring_queue_rearm(r, fd, st);
+}
+
+int ae_create() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = AE_URING_CQ_ENTRIES;
+    int fd = syscall(__NR_io_uring_setup, AE_URING_ENTRIES, &p);
+    if (fd < 0)
+        return -1;
+    ae_uring_t *r = calloc(1, sizeof(ae_uring_t));
+    if (r == NULL) {
+        close(fd);
+        return -1;
+    }
+    r->fd = fd;
+    r->sq_entries = p.sq_entries;
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_sz > r->sq_ring_sz)
+            r->sq_ring_sz = r->cq_ring_sz;
+        r->cq_ring_sz = r->sq_ring_sz;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            munmap(r->sq_ring, r->sq_ring_sz);
+            goto error;
+        }
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        if (r->cq_ring != r->sq_ring)
+            munmap(r->cq_ring, r->cq_ring_sz);
+        munmap(r->sq_ring, r->sq_ring_sz);
+        goto error;
+    }
+    r->sq_head = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+    r->sqe_tail = *r->sq_tail;
+    // an older kernel polls every fd instead
+    uring_setup_bufs(r);
+    r->next = rings;
+    rings = r;
+    return fd;
+error:
+    free(r);
+    close(fd);
+    return -1;
+}
+
+int ae_free(int aefd) {
+    ae_uring_t **pr, *r;
+    for (pr = &rings; (r = *pr) != NULL; pr = &r->next) {
+        if (r->fd == aefd) {
+            *pr = r->next;
+            // blocks in flight may still be read by the kernel, they leak
+            for (int fd = 0; fd < r->nfds; fd++)
+                free(r->fds[fd].queued);
+            munmap(r->sqes, r->sqes_sz);
+            if (r->cq_ring != r->sq_ring)
+                munmap(r->cq_ring, r->cq_ring_sz);
+            munmap(r->sq_ring, r->sq_ring_sz);
+            if (r->br)
+                munmap(r->br, r->br_sz);
+            free(r->buf_next);
+            free(r->buf_len);
+            free(r->fds);
+            free(r->rearm.fds);
+            free(r->ready.fds);
+            free(r->sendq.fds);
+            free(r);
+            break;
+        }
+    }
+    return close(aefd);
+}
+
+int ae_add_read(int aefd, int fd) {
+    return uring_add(aefd, fd, AE_READABLE, 0);
+}
+
+int ae_add_write(int aefd, int fd) {
+    return uring_add(aefd, fd, AE_WRITABLE, 0);
+}
+
+int ae_add_read_et(int aefd, int fd) {
+    return uring_add(aefd, fd, AE_READABLE | AE_WRITABLE, 1);
+}
+
+int ae_del_event(int aefd, int fd) {
+    ae_uring_t *r = uring_get(aefd);
+    if (r == NULL)
+        return 0;
+    if (fd < 0 || fd >= r->nfds || !r->fds[fd].added) {
+        errno = ENOENT;
+        return 0;
+    }
+    ae_fdstate_t *st = &r->fds[fd];
+    if (st->recv) {
+        if (st->armed)
+            uring_cancel(r, uring_ud(st, fd, AE_URING_RECV));
+        st->armed = 0;
+        st->gen++;
+        uring_drop_recv(r, st);
+        uring_orphan_sends(r, fd, st);
+        st->recv = 0;
+    } else {
+        uring_disarm(r, fd, st);
+    }
+    st->added = 0;
+    st->mask = 0;
+    st->et = 0;
+    return 1;
+}
+
+int ae_enable_event(int aefd, int fd, bool readable, bool writable) {
+    ae_uring_t *r = uring_get(aefd);
+    if (r == NULL)
+        return 0;
+    if (fd < 0 || fd >= r->nfds || !r->fds[fd].added) {
+        errno = ENOENT;
+        return 0;
+    }
+    ae_fdstate_t *st = &r->fds[fd];
+    int mask = (readable ? AE_READABLE : 0) | (writable ? AE_WRITABLE : 0);
+    if (!st->recv && !st->probed && readable) {
+        uring_probe(r, fd, st);
+        // drop the poll of connect, the socket is read by recv from now on
+        if (st->recv) {
+            uring_disarm(r, fd, st);
+            st->mask = 0;
+        }
+    }
+    if (st->recv) {
+        if ((mask & AE_READABLE) && !st->armed)
+            uring_queue_rearm(r, fd, st);
+        // reads pause, the kernel keeps what arrives meanwhile
+        if (!(mask & AE_READABLE) && st->armed && !st->canceling) {
+            uring_cancel(r, uring_ud(st, fd, AE_URING_RECV));
+            st->canceling = 1;
+        }
+        st->mask = mask;
+        st->et = 0;
+        uring_queue_ready(r, fd, st);
+        return 1;
+    }
+    if (st->mask == mask && !st->et && (st->armed || st->pending))
+        return 1;
+    uring_disarm(r, fd, st);
+    st->mask = mask;
+    st->et = 0;
+    return uring_queue_rearm(r, fd, st);
+}
+
+int ae_poll(int aefd, event_t *fired, int nfire, int timeout) {
+    ae_uring_t *r = uring_get(aefd);
+    if (r == NULL)
+        return -1;
+    r->epoch++;
+    uring_flush_rearm(r);
+    uring_flush_sends(r);
+    // queued bytes and send room are reported without waiting
+    int n = uring_fire_ready(r, fired, 0, nfire);
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) && n == 0) {
+        if (timeout != 0) {
+            if (uring_enter(r, 1, timeout) < 0)
+                return -1;
+        } else if (r->sqe_tail != *r->sq_tail) {
+            uring_enter(r, 0, 0);
+        }
+    } else if (r->sqe_tail != *r->sq_tail) {
+        uring_enter(r, 0, 0);
+    }
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < nfire) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        head++;
+        uint64_t ud = cqe->user_data;
+        int kind = ud & 3;
+        if (kind == AE_URING_SEND) {
+            uring_send_done(r, (ae_send_t *)(uintptr_t)(ud & ~(uint64_t)3), cqe->res);
+            continue;
+        }
+        if (ud == AE_URING_UD_IGNORE)
+            continue;
+        int fd = (int)((uint32_t)ud >> 2);
+        uint32_t gen = (uint32_t)(ud >> 32);
+        if (kind == AE_URING_RECV) {
+            uring_recv_done(r, cqe, fd, gen);
+            continue;
+        }
+        if (fd >= r->nfds)
+            continue;
+        ae_fdstate_t *st = &r->fds[fd];
+        if (!st->added || st->recv || st->gen != gen)
+            continue;
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            st->armed = 0;
+            uring_queue_rearm(r, fd, st);
+        }
+        int mask;
+        if (cqe->res < 0) {
+            if (cqe->res == -ECANCELED)
+                continue;
+            mask = POLLERR;
+        } else {
+            mask = cqe->res;
+        }
+        if (mask & POLLHUP)
+            mask |= (POLLIN | POLLOUT);
+        fired[n].fd = fd;
+        fired[n].read = (mask & POLLIN) != 0;
+        fired[n].write = (mask & POLLOUT) != 0;
+        fired[n].error = (mask & (POLLERR | POLLHUP)) != 0;
+        n++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return uring_fire_ready(r, fired, n, nfire);
+}
+
+int ae_readv(int fd, const struct iovec *iov, int cnt) {
+    ae_uring_t *r;
+    ae_fdstate_t *st = uring_conn(fd, &r);
+    if (st == NULL)
+        return cnt == 1 ? anet_tcp_read(fd, iov[0].iov_base, iov[0].iov_len)
+                        : anet_tcp_readv(fd, iov, cnt);
+    int n = 0;
+    for (int i = 0; i < cnt && st->rbytes > 0; i++) {
+        char *dst = iov[i].iov_base;
+        size_t want = iov[i].iov_len;
+        while (want > 0 && st->rbytes > 0) {
+            int bid = st->head;
+            uint32_t left = r->buf_len[bid] - st->off;
+            uint32_t copy = left < want ? left : (uint32_t)want;
+            memcpy(dst, r->bufs + (size_t)bid * AE_URING_BUF_SIZE + st->off, copy);
+            dst += copy;
+            want -= copy;
+            n += copy;
+            st->off += copy;
+            st->rbytes -= copy;
+            if (st->off == r->buf_len[bid]) {
+                st->off = 0;
+                st->head = r->buf_next[bid];
+                r->bufs_held--;
+                uring_buf_put(r, bid);
+            }
+        }
+    }
+    if (n > 0)
+        return n;
+    if (st->err) {
+        errno = st->err;
+        return -1;
+    }
+    if (st->eof)
+        return 0;
+    errno = EAGAIN;
+    return -2;
+}
+
+int ae_writev(int fd, const struct iovec *iov, int cnt) {
+    ae_uring_t *r;
+    ae_fdstate_t *st = uring_conn(fd, &r);
+    if (st == NULL) {
+        if (cnt == 0)
+            return 0;
+        return cnt == 1 ? anet_tcp_write(fd, iov[0].iov_base, iov[0].iov_len)
+                        : anet_tcp_writev(fd, iov, cnt);
+    }
+    if (st->err) {
+        errno = st->err;
+        return -1;
+    }
+    if (uring_send_bytes(st) >= AE_URING_SEND_MAX) {
+        st->wblocked = 1;
+        errno = EAGAIN;
+        return -2;
+    }
+    size_t total = 0;
+    for (int i = 0; i < cnt; i++)
+        total += iov[i].iov_len;
+    if (total == 0)
+        return 0;
+    ae_send_t *s = st->queued;
+    uint32_t len = s ? s->len : 0;
+    if (s == NULL || len + total > s->cap) {
+        uint32_t cap = s && s->cap ? s->cap : 4096;
+        while (cap < len + total)
+            cap <<= 1;
+        s = realloc(s, sizeof(ae_send_t) + cap);
+        if (s == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (st->queued == NULL)
+            memset(s, 0, sizeof(ae_send_t));
+        s->cap = cap;
+        st->queued = s;
+    }
+    for (int i = 0; i < cnt; i++) {
+        memcpy(s->data + s->len, iov[i].iov_base, iov[i].iov_len);
+        s->len += iov[i].iov_len;
+    }
+    if (!st->insend && fdlist_push(&r->sendq, fd))
+        st->insend = 1;
+    return (int)total;
+}
+
+#else
+#include <sys/epoll.h>
+
 int ae_create() {
     return epoll_create(1);
 }
@@ -40,6 +998,16 @@ int ae_add_write(int aefd, int fd) {
     return epoll_ctl(aefd, EPOLL_CTL_ADD, fd, &e) != -1;
 }
 
+// Edge-triggered registration covers both directions at once: writable
+// edges only fire on transitions, so EPOLLOUT never has to be toggled with
+// ae_enable_event. Callers must read/write until EAGAIN on every event.
+int ae_add_read_et(int aefd, int fd) {
+    struct epoll_event e;
+    e.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    e.data.fd = fd;
+    return epoll_ctl(aefd, EPOLL_CTL_ADD, fd, &e) != -1;
+}
+
 int ae_del_event(int aefd, int fd) {
     return epoll_ctl(aefd, EPOLL_CTL_DEL, fd, NULL) != -1;
 }
@@ -67,6 +1035,20 @@ int ae_poll(int aefd, event_t *fired, int nfire, int timeout) {
     return n;
 }
 
+int ae_readv(int fd, const struct iovec *iov, int cnt) {
+    return cnt == 1 ? anet_tcp_read(fd, iov[0].iov_base, iov[0].iov_len)
+                    : anet_tcp_readv(fd, iov, cnt);
+}
+
+int ae_writev(int fd, const struct iovec *iov, int cnt) {
+    if (cnt == 0)
+        return 0;
+    return cnt == 1 ? anet_tcp_write(fd, iov[0].iov_base, iov[0].iov_len)
+                    : anet_tcp_writev(fd, iov, cnt);
+}
+
+#endif
+
 int ae_wait(int fd, int mask, int timeout) {
     struct pollfd pfd;
     int retmask = 0, retval;
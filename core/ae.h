@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #define AE_NONE 0       /* No events registered. */
 #define AE_READABLE 1   /* Fire when descriptor is readable. */
@@ -15,6 +16,8 @@
 #define AE_ERR  4
 
 #define AE_MAXEVENT 64
+// upper bound of the adaptive fired array, see lua-ae.c poll_batch
+#define AE_MAXEVENT_LIMIT 4096
 
 typedef struct {
     int fd;
@@ -33,10 +36,17 @@ int ae_create();
 int ae_free(int aefd);
 int ae_add_read(int aefd, int fd);
 int ae_add_write(int aefd, int fd);
+int ae_add_read_et(int aefd, int fd);
 int ae_del_event(int aefd, int fd);
 int ae_enable_event(int aefd, int fd, bool readable, bool writable);
 int ae_wait(int fd, int mask, int timeout);
 int ae_poll(int aefd, event_t *fired, int nfire, int timeout);
+// reads and writes of connections, same returns as anet_tcp_readv/writev.
+// the io_uring backend serves registered stream sockets from its recv
+// buffers and queues writes for one batched submission, then a write
+// sees EAGAIN (-2) once too much is queued. cnt 0 probes for that
+int ae_readv(int fd, const struct iovec *iov, int cnt);
+int ae_writev(int fd, const struct iovec *iov, int cnt);
 const char * socket_error(int fd);
 
 #endif
\ No newline at end of file
@@ -1,33 +1,98 @@
+#define _GNU_SOURCE
 #include "anet.h"
+#ifdef AE_USE_IO_URING
+#include "ae.h"
+#endif
 
-enum TCP_SOCK_OPTION {
-    SOCK_OPT_KEEPALIVE = 1,
-    SOCK_OPT_REUSEADDR,
-    SOCK_OPT_TCP_NODELAY,
-    SOCK_OPT_SNDBUF,
-    SOCK_OPT_RCVBUF,
-};
+#define ANET_PUMP_CHUNK 65536   // default pipe capacity
 
+// numeric v4 or v6 address, NULL binds every v4 address
 int
-anet_tcp_listen(const char *bindaddr, int port, int backlog) {
+anet_sockaddr(const char *addr, int port, struct sockaddr_storage *ss, socklen_t *len) {
+    memset(ss, 0, sizeof(*ss));
+    struct sockaddr_in *sa4 = (struct sockaddr_in *)ss;
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)ss;
+    if (addr == NULL) {
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons(port);
+        sa4->sin_addr.s_addr = INADDR_ANY;
+        *len = sizeof(*sa4);
+    } else if (inet_pton(AF_INET, addr, &sa4->sin_addr) == 1) {
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons(port);
+        *len = sizeof(*sa4);
+    } else if (inet_pton(AF_INET6, addr, &sa6->sin6_addr) == 1) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(port);
+        *len = sizeof(*sa6);
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+_anet_unix_sockaddr(const char *path, struct sockaddr_un *sa) {
+    memset(sa, 0, sizeof(*sa));
+    if (strlen(path) >= sizeof(sa->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+static int
+_anet_listen(int s, struct sockaddr *sa, socklen_t len, int backlog) {
+    if (bind(s, sa, len) == -1) goto error;
+    if (listen(s, backlog) == -1) goto error;
+    if (_anet_tcp_set_nonblock(s) == -1) goto error;
+    return s;
+
+error:
+    close(s);
+    return -1;
+}
+
+int
+anet_tcp_listen(const char *bindaddr, int port, int backlog, int reuseport) {
     int s;
-    struct sockaddr_in servaddr;
+    struct sockaddr_storage servaddr;
+    socklen_t len;
 
-    if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    if (anet_sockaddr(bindaddr, port, &servaddr, &len) == -1)
+        return -1;
+    if ((s = socket(servaddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
         return -1;
     }
 
     if (anet_tcp_setoption(s, SOCK_OPT_REUSEADDR, 1) == -1) goto error;
+    // 多个事件循环线程各自监听同一端口，由内核分发连接
+    if (reuseport && anet_tcp_setoption(s, SOCK_OPT_REUSEPORT, 1) == -1) goto error;
 
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(port);
-    servaddr.sin_addr.s_addr = bindaddr ? inet_addr(bindaddr) : INADDR_ANY;
+    return _anet_listen(s, (struct sockaddr*)&servaddr, len, backlog);
 
-    if (bind(s, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1) goto error;
-    if (listen(s, backlog) == -1) goto error;
-    if (_anet_tcp_set_nonblock(s) == -1) goto error;
+error:
+    close(s);
+    return -1;
+}
 
+int
+anet_udp_bind(const char *bindaddr, int port, int reuseport) {
+    int s;
+    struct sockaddr_storage sa;
+    socklen_t len;
+
+    if (anet_sockaddr(bindaddr, port, &sa, &len) == -1)
+        return -1;
+    if ((s = socket(sa.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    if (anet_tcp_setoption(s, SOCK_OPT_REUSEADDR, 1) == -1) goto error;
+    if (reuseport && anet_tcp_setoption(s, SOCK_OPT_REUSEPORT, 1) == -1) goto error;
+    if (bind(s, (struct sockaddr*)&sa, len) == -1) goto error;
     return s;
 
 error:
@@ -35,12 +100,56 @@ error:
     return -1;
 }
 
-int anet_tcp_accept(int fd, char* ip, int *port) {
-    int clientfd;
-    struct sockaddr_storage sa;
-    socklen_t salen = sizeof(sa);
+int
+anet_unix_listen(const char *path, int backlog) {
+    int s;
+    struct sockaddr_un sa;
+    struct stat st;
+
+    if (_anet_unix_sockaddr(path, &sa) == -1)
+        return -1;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        // only a file left behind by a previous run is removed, never a live server's
+        if ((s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+            return -1;
+        int live = connect(s, (struct sockaddr*)&sa, sizeof(sa)) == 0 || errno == EAGAIN;
+        int stale = !live && errno == ECONNREFUSED;
+        close(s);
+        if (live) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+        if (stale)
+            unlink(path);
+    }
+    if ((s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    return _anet_listen(s, (struct sockaddr*)&sa, sizeof(sa), backlog);
+}
+
+void
+anet_sockaddr_str(struct sockaddr_storage *sa, char *ip, int *port) {
+    if (sa->ss_family == AF_UNIX) {
+        if (ip) strcpy(ip, "unix");
+        if (port) *port = 0;
+    } else if (sa->ss_family == AF_INET6) {
+        struct sockaddr_in6 *s = (struct sockaddr_in6 *)sa;
+        if (ip) inet_ntop(AF_INET6, (void*)&(s->sin6_addr), ip, INET6_ADDRSTRLEN);
+        if (port) *port = ntohs(s->sin6_port);
+    } else {
+        struct sockaddr_in *s = (struct sockaddr_in *)sa;
+        if (ip) inet_ntop(AF_INET, (void*)&(s->sin_addr), ip, INET_ADDRSTRLEN);
+        if (port) *port = ntohs(s->sin_port);
+    }
+}
+
+// accept4 hands back a nonblocking fd, no fcntl round trips per connection
+static int
+_anet_accept4(int fd, struct sockaddr_storage *sa) {
+    socklen_t salen = sizeof(*sa);
     while (1) {
-        clientfd = accept(fd, (struct sockaddr*)&sa, &salen);
+        int clientfd = accept4(fd, (struct sockaddr*)sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientfd == -1) {
             if (errno == EINTR)
                 continue;
@@ -50,34 +159,75 @@ int anet_tcp_accept(int fd, char* ip, int *port) {
                 return -1;
             }
         }
-        break;
+        return clientfd;
     }
-    struct sockaddr_in *s = (struct sockaddr_in *)&sa;
-    if (ip) inet_ntop(AF_INET, (void*)&(s->sin_addr), ip, INET_ADDRSTRLEN);
-    if (port) *port = ntohs(s->sin_port);
+}
+
+int anet_tcp_accept(int fd, char* ip, int *port) {
+    struct sockaddr_storage sa;
+    int clientfd = _anet_accept4(fd, &sa);
+    if (clientfd <= 0)
+        return clientfd;
+    anet_sockaddr_str(&sa, ip, port);
     return clientfd;
 }
 
-int anet_tcp_connect(const char *addr, int port) {
+int anet_tcp_accept_batch(int fd, anet_conn_t *conns, int max, const anet_profile_t *profile,
+    anet_accept_filter filter, void *ud) {
+    struct sockaddr_storage sa;
+    int n = 0;
+    // rejected connections count too, a flood can't keep us here
+    for (int taken = 0; taken < max; taken++) {
+        int clientfd = _anet_accept4(fd, &sa);
+        if (clientfd == 0)
+            break;
+        if (clientfd == -1) {
+            // the peer gave up before we got to it, try the next one
+            if (errno == ECONNABORTED || errno == EPROTO)
+                continue;
+            if (n > 0)
+                break;
+            return -1;
+        }
+        if (filter && !filter(&sa, ud)) {
+            // reset instead of fin, no TIME_WAIT is left behind for it
+            struct linger lg = {1, 0};
+            setsockopt(clientfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+            close(clientfd);
+            continue;
+        }
+        if (profile)
+            anet_profile_apply(clientfd, profile);
+        conns[n].fd = clientfd;
+        anet_sockaddr_str(&sa, conns[n].ip, &conns[n].port);
+        n++;
+    }
+    return n;
+}
+
+int anet_tcp_connect(const char *addr, int port, const anet_profile_t *profile) {
     int s;
-    struct sockaddr_in servaddr;
+    struct sockaddr_storage servaddr;
+    socklen_t len;
 
-    if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    if (anet_sockaddr(addr, port, &servaddr, &len) == -1)
+        return -1;
+    if ((s = socket(servaddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
         return -1;
     }
 
     if (anet_tcp_setoption(s, SOCK_OPT_REUSEADDR, 1) == -1) goto error;
     if (anet_tcp_setoption(s, SOCK_OPT_KEEPALIVE, 1) == -1) goto error;
-    if (_anet_tcp_set_nonblock(s) == -1) goto error;
-
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_port = htons(port);
-    if (inet_pton(AF_INET, addr, &servaddr.sin_addr) <= 0) {
-        goto error;
+    // before connect() so that buffer sizes shape the window scale of the syn
+    if (profile) {
+        anet_profile_apply(s, profile);
+#ifdef TCP_FASTOPEN_CONNECT
+        if (profile->val[SOCK_OPT_FASTOPEN] > 0)
+            setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &(int){1}, sizeof(int));
+#endif
     }
 
-    if (connect(s, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1 && errno != EINPROGRESS) {
+    if (connect(s, (struct sockaddr*)&servaddr, len) == -1 && errno != EINPROGRESS) {
         close(s);
         return -1;
     }
@@ -89,6 +239,24 @@ error:
     return -1;
 }
 
+// a unix connect completes right away or fails, EAGAIN means the
+// listener's backlog is full
+int anet_unix_connect(const char *path) {
+    int s;
+    struct sockaddr_un sa;
+
+    if (_anet_unix_sockaddr(path, &sa) == -1)
+        return -1;
+    if ((s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        return -1;
+    }
+    if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
 int anet_tcp_close(int fd) {
     return close(fd);
 }
@@ -109,6 +277,21 @@ int anet_tcp_read(int fd, void* buf, int sz) {
     return 0;
 }
 
+int anet_tcp_readv(int fd, const struct iovec *iov, int cnt) {
+    while (1) {
+        ssize_t n = readv(fd, iov, cnt);
+        if (n == 0) return 0;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK)
+                return -2;
+            return -1;
+        }
+        return (int)n;
+    }
+}
+
 int anet_tcp_write(int fd, const void *buf, int sz) {
     while (1) {
         int n = write(fd, buf, sz);
@@ -124,6 +307,100 @@ int anet_tcp_write(int fd, const void *buf, int sz) {
     return 0;
 }
 
+// same returns as anet_tcp_write: bytes written, -2 on EAGAIN, -1 on error
+int anet_tcp_writev(int fd, const struct iovec *iov, int cnt) {
+    while (1) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK)
+                return -2;
+            return -1;
+        }
+        return (int)n;
+    }
+}
+
+int anet_pump_open(anet_pump_t *p) {
+    p->pending = 0;
+    return pipe2(p->pipe, O_NONBLOCK | O_CLOEXEC);
+}
+
+void anet_pump_close(anet_pump_t *p) {
+    close(p->pipe[0]);
+    close(p->pipe[1]);
+    p->pending = 0;
+}
+
+static int
+_anet_splice(int in, int out, size_t len) {
+    while (1) {
+        ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return -2;
+            return -1;
+        }
+        return (int)n;
+    }
+}
+
+// src is only read with the pipe empty, so EAGAIN there means src has nothing
+int anet_pump(anet_pump_t *p, int src, int dst, uint64_t *moved) {
+    *moved = 0;
+    for (;;) {
+        while (p->pending > 0) {
+            int n = _anet_splice(p->pipe[0], dst, p->pending);
+            if (n == -2)
+                return ANET_PUMP_WRITE;
+            if (n < 0)
+                return -1;
+            p->pending -= n;
+            *moved += n;
+        }
+#ifdef AE_USE_IO_URING
+        // the ring reads connected sockets itself and queues their writes,
+        // the bytes are copied through it instead of spliced. only a short
+        // write to a polled dst parks the rest in the pipe
+        if (ae_writev(dst, NULL, 0) == -2)
+            return ANET_PUMP_WRITE;
+        char buf[ANET_PUMP_CHUNK];
+        struct iovec iov = { buf, sizeof(buf) };
+        int n = ae_readv(src, &iov, 1);
+        if (n == -2)
+            return ANET_PUMP_READ;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return ANET_PUMP_EOF;
+        iov.iov_len = n;
+        int w = ae_writev(dst, &iov, 1);
+        if (w == -2)
+            w = 0;
+        if (w < 0)
+            return -1;
+        *moved += w;
+        if (w < n) {
+            if (write(p->pipe[1], buf + w, n - w) != n - w)
+                return -1;
+            p->pending = n - w;
+        }
+#else
+        int n = _anet_splice(src, p->pipe[1], ANET_PUMP_CHUNK);
+        if (n == -2)
+            return ANET_PUMP_READ;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return ANET_PUMP_EOF;
+        p->pending = n;
+#endif
+    }
+}
+
 int _anet_tcp_set_nonblock(int fd) {
     int flag = fcntl(fd, F_GETFL, 0);
     if (flag == -1) {
@@ -132,62 +409,119 @@ int _anet_tcp_set_nonblock(int fd) {
     return fcntl(fd, F_SETFL, flag | O_NONBLOCK);
 }
 
-int anet_tcp_getoption(int fd, int option, int *val) {
-    socklen_t len = sizeof(int);
-    int level, optname;
+static int
+_anet_optname(int option, int *level, int *optname) {
     switch (option) {
     case SOCK_OPT_KEEPALIVE:
-        level = SOL_SOCKET;
-        optname = SO_KEEPALIVE;
+        *level = SOL_SOCKET;
+        *optname = SO_KEEPALIVE;
         break;
     case SOCK_OPT_REUSEADDR:
-        level = SOL_SOCKET;
-        optname = SO_REUSEADDR;
+        *level = SOL_SOCKET;
+        *optname = SO_REUSEADDR;
         break;
     case SOCK_OPT_TCP_NODELAY:
-        level = IPPROTO_TCP;
-        optname = TCP_NODELAY;
+        *level = IPPROTO_TCP;
+        *optname = TCP_NODELAY;
         break;
     case SOCK_OPT_SNDBUF:
-        level = SOL_SOCKET;
-        optname = SO_RCVBUF;
+        *level = SOL_SOCKET;
+        *optname = SO_SNDBUF;
         break;
     case SOCK_OPT_RCVBUF:
-        level = SOL_SOCKET;
-        optname = SO_SNDBUF;
+        *level = SOL_SOCKET;
+        *optname = SO_RCVBUF;
+        break;
+    case SOCK_OPT_REUSEPORT:
+        *level = SOL_SOCKET;
+        *optname = SO_REUSEPORT;
+        break;
+#ifdef SO_BUSY_POLL
+    // usec to busy poll the device queue on a blocking read, raising it
+    // above net.core.busy_read needs CAP_NET_ADMIN
+    case SOCK_OPT_BUSY_POLL:
+        *level = SOL_SOCKET;
+        *optname = SO_BUSY_POLL;
+        break;
+#endif
+    // seconds to hold a connection in the kernel until its first data arrives
+    case SOCK_OPT_DEFER_ACCEPT:
+        *level = IPPROTO_TCP;
+        *optname = TCP_DEFER_ACCEPT;
+        break;
+    // ack right away instead of delaying, the kernel may fall back to
+    // delayed acks later so it is set again on every accepted socket
+    case SOCK_OPT_QUICKACK:
+        *level = IPPROTO_TCP;
+        *optname = TCP_QUICKACK;
+        break;
+    // on a listener: length of the pending fast open queue
+    case SOCK_OPT_FASTOPEN:
+        *level = IPPROTO_TCP;
+        *optname = TCP_FASTOPEN;
+        break;
+    // msec unacked data may stay in flight before the connection is dropped
+    case SOCK_OPT_USER_TIMEOUT:
+        *level = IPPROTO_TCP;
+        *optname = TCP_USER_TIMEOUT;
+        break;
+    // writable only while less than this many bytes are unsent
+    case SOCK_OPT_NOTSENT_LOWAT:
+        *level = IPPROTO_TCP;
+        *optname = TCP_NOTSENT_LOWAT;
+        break;
+    case SOCK_OPT_KEEPIDLE:
+        *level = IPPROTO_TCP;
+        *optname = TCP_KEEPIDLE;
+        break;
+    case SOCK_OPT_KEEPINTVL:
+        *level = IPPROTO_TCP;
+        *optname = TCP_KEEPINTVL;
+        break;
+    case SOCK_OPT_KEEPCNT:
+        *level = IPPROTO_TCP;
+        *optname = TCP_KEEPCNT;
+        break;
+    case SOCK_OPT_CORK:
+        *level = IPPROTO_TCP;
+        *optname = TCP_CORK;
         break;
     default:
         return -2;
     }
+    return 0;
+}
+
+int anet_tcp_getoption(int fd, int option, int *val) {
+    socklen_t len = sizeof(int);
+    int level, optname;
+    if (_anet_optname(option, &level, &optname) == -2)
+        return -2;
     return getsockopt(fd, level, optname, (void *) val, &len);
 }
 
 int anet_tcp_setoption(int fd, int option, int val) {
     socklen_t len = sizeof(int);
     int level, optname;
-    switch (option) {
-    case SOCK_OPT_KEEPALIVE:
-        level = SOL_SOCKET;
-        optname = SO_KEEPALIVE;
-        break;
-    case SOCK_OPT_REUSEADDR:
-        level = SOL_SOCKET;
-        optname = SO_REUSEADDR;
-        break;
-    case SOCK_OPT_TCP_NODELAY:
-        level = IPPROTO_TCP;
-        optname = TCP_NODELAY;
-        break;
-    case SOCK_OPT_SNDBUF:
-        level = SOL_SOCKET;
-        optname = SO_RCVBUF;
-        break;
-    case SOCK_OPT_RCVBUF:
-        level = SOL_SOCKET;
-        optname = SO_SNDBUF;
-        break;
-    default:
+    if (_anet_optname(option, &level, &optname) == -2)
         return -2;
-    }
     return setsockopt(fd, level, optname, (const void *) &val, len);
 }
+
+void anet_profile_init(anet_profile_t *p) {
+    for (int i = 0; i < SOCK_OPT_MAX; i++)
+        p->val[i] = -1;
+}
+
+// best effort: every option is tried, -1 if any of them failed
+int anet_profile_apply(int fd, const anet_profile_t *p) {
+    int ret = 0;
+    for (int i = 1; i < SOCK_OPT_MAX; i++) {
+        // fast open belongs to the listener or to connect()
+        if (p->val[i] < 0 || i == SOCK_OPT_FASTOPEN)
+            continue;
+        if (anet_tcp_setoption(fd, i, p->val[i]) != 0)
+            ret = -1;
+    }
+    return ret;
+}
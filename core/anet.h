@@ -1,11 +1,15 @@
 #ifndef async_net_h
 #define async_net_h
 
+#include <stdint.h>
 #include <netdb.h>
 #include <errno.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -13,19 +17,89 @@
 #include <string.h>
 #include <stdio.h>
 
-//-- bind and listen
-int anet_tcp_listen(const char *bindaddr, int port, int backlog);
+enum TCP_SOCK_OPTION {
+    SOCK_OPT_KEEPALIVE = 1,
+    SOCK_OPT_REUSEADDR,
+    SOCK_OPT_TCP_NODELAY,
+    SOCK_OPT_SNDBUF,
+    SOCK_OPT_RCVBUF,
+    SOCK_OPT_REUSEPORT,
+    SOCK_OPT_BUSY_POLL,
+    SOCK_OPT_DEFER_ACCEPT,
+    SOCK_OPT_QUICKACK,
+    SOCK_OPT_FASTOPEN,
+    SOCK_OPT_USER_TIMEOUT,
+    SOCK_OPT_NOTSENT_LOWAT,
+    SOCK_OPT_KEEPIDLE,
+    SOCK_OPT_KEEPINTVL,
+    SOCK_OPT_KEEPCNT,
+    SOCK_OPT_CORK,
+    SOCK_OPT_MAX,
+};
+
+typedef struct {
+    int fd;
+    int port;
+    char ip[INET6_ADDRSTRLEN];
+} anet_conn_t;
+
+// option values applied to every accepted or connected socket, -1 leaves
+// an option alone. val[SOCK_OPT_FASTOPEN] > 0 turns on fast open for connect
+typedef struct {
+    int val[SOCK_OPT_MAX];
+} anet_profile_t;
+
+// a pipe that splices bytes from one socket to another in the kernel
+typedef struct {
+    int pipe[2];
+    int pending;    // bytes in the pipe not yet spliced out
+} anet_pump_t;
+
+enum ANET_PUMP_STATE {
+    ANET_PUMP_READ = 0,     // src drained, the pipe is empty
+    ANET_PUMP_WRITE,        // dst is full, bytes wait in the pipe
+    ANET_PUMP_EOF,          // src closed and everything went out
+};
+
+//-- bind and listen, bindaddr may be a v4 or v6 address
+int anet_tcp_listen(const char *bindaddr, int port, int backlog, int reuseport);
+int anet_unix_listen(const char *path, int backlog);
+// nonblocking datagram socket, port 0 picks an ephemeral one
+int anet_udp_bind(const char *bindaddr, int port, int reuseport);
 
 //-- connection
 int anet_tcp_accept(int fd, char* ip, int *port);
-int anet_tcp_connect(const char *addr, int port);
+// decides on a connection right after accept, 0 closes it at once
+typedef int (*anet_accept_filter)(const struct sockaddr_storage *sa, void *ud);
+
+// accept up to max connections (nonblocking, cloexec), returns the number
+// accepted, 0 if none is pending, -1 on error when nothing was accepted.
+// profile and filter may be NULL
+int anet_tcp_accept_batch(int fd, anet_conn_t *conns, int max, const anet_profile_t *profile,
+    anet_accept_filter filter, void *ud);
+int anet_tcp_connect(const char *addr, int port, const anet_profile_t *profile);
+int anet_unix_connect(const char *path);
 int anet_tcp_close(int fd);
 int anet_tcp_read(int fd, void* buf, int sz);
+int anet_tcp_readv(int fd, const struct iovec *iov, int cnt);
 int anet_tcp_write(int fd, const void* buf, int sz);
+int anet_tcp_writev(int fd, const struct iovec *iov, int cnt);
+
+//-- forwarding
+int anet_pump_open(anet_pump_t *p);
+void anet_pump_close(anet_pump_t *p);
+// moves bytes src -> pipe -> dst until a side would block or src reaches eof,
+// returns an ANET_PUMP_STATE or -1 on error, *moved gets the bytes written to dst
+int anet_pump(anet_pump_t *p, int src, int dst, uint64_t *moved);
 
 //-- utils
+// numeric v4/v6 address to sockaddr, and back to "ip" + port
+int anet_sockaddr(const char *addr, int port, struct sockaddr_storage *ss, socklen_t *len);
+void anet_sockaddr_str(struct sockaddr_storage *sa, char *ip, int *port);
 int _anet_tcp_set_nonblock(int fd);
 int anet_tcp_getoption(int fd, int option, int *val);
 int anet_tcp_setoption(int fd, int option, int val);
+void anet_profile_init(anet_profile_t *p);
+int anet_profile_apply(int fd, const anet_profile_t *p);
 
 #endif
\ No newline at end of file
@@ -11,6 +11,43 @@
 #define BUFFER_CHAIN_MAX 16*1024*1024  // 16M
 #define BUFFER_CHAIN_EXTRA(t, c) (t *)((buf_chain_t *)(c) + 1)
 #define BUFFER_CHAIN_SIZE sizeof(buf_chain_t)
+#define CHAIN_CACHE_CLASSES 7                    // 1K 2K 4K ... 64K
+#define CHAIN_CACHE_DEFAULT_LIMIT (256 * 1024)   // bytes per class
+
+// chains freed by a loop are reused by the same loop, one cache per thread
+typedef struct {
+    buf_chain_t *head;
+    uint32_t count;
+} chain_cache_t;
+
+static __thread chain_cache_t chain_cache[CHAIN_CACHE_CLASSES];
+static __thread uint32_t chain_cache_limit = CHAIN_CACHE_DEFAULT_LIMIT;
+static __thread buffer_cache_stat_t cache_stat;
+
+// size class of an allocation of to_alloc bytes, -1 if it isn't cached
+static inline int
+chain_cache_class(uint32_t to_alloc) {
+    if (to_alloc < MIN_BUFFER_SIZE || (to_alloc & (to_alloc - 1)) != 0)
+        return -1;
+    int cls = __builtin_ctz(to_alloc) - __builtin_ctz(MIN_BUFFER_SIZE);
+    return cls < CHAIN_CACHE_CLASSES ? cls : -1;
+}
+
+static void
+buf_chain_free(buf_chain_t *chain) {
+    uint32_t to_alloc = chain->buffer_len + BUFFER_CHAIN_SIZE;
+    int cls = chain_cache_class(to_alloc);
+    if (cls >= 0 && (chain_cache[cls].count + 1) * to_alloc <= chain_cache_limit) {
+        chain->next = chain_cache[cls].head;
+        chain_cache[cls].head = chain;
+        chain_cache[cls].count++;
+        cache_stat.cached++;
+        cache_stat.cached_bytes += to_alloc;
+        return;
+    }
+    cache_stat.releases++;
+    free(chain);
+}
 
 static buf_chain_t *
 buf_chain_new(uint32_t size) {
@@ -28,8 +65,19 @@ buf_chain_new(uint32_t size) {
     } else {
         to_alloc = size;
     }
-    if ((chain = malloc(to_alloc)) == NULL)
-        return (NULL);
+    int cls = chain_cache_class(to_alloc);
+    if (cls >= 0 && chain_cache[cls].head) {
+        chain = chain_cache[cls].head;
+        chain_cache[cls].head = chain->next;
+        chain_cache[cls].count--;
+        cache_stat.hits++;
+        cache_stat.cached--;
+        cache_stat.cached_bytes -= to_alloc;
+    } else {
+        if ((chain = malloc(to_alloc)) == NULL)
+            return (NULL);
+        cache_stat.misses++;
+    }
     memset(chain, 0, BUFFER_CHAIN_SIZE);
     chain->buffer_len = to_alloc - BUFFER_CHAIN_SIZE;
     chain->buffer = BUFFER_CHAIN_EXTRA(uint8_t, chain);
@@ -40,10 +88,29 @@ void buf_chain_free_all(buf_chain_t *chain) {
     buf_chain_t *next;
     for (; chain; chain = next) {
         next = chain->next;
-        free(chain);
+        buf_chain_free(chain);
     }
 }
 
+void buffer_cache_limit(uint32_t bytes) {
+    chain_cache_limit = bytes;
+    for (int i = 0; i < CHAIN_CACHE_CLASSES; i++) {
+        uint32_t size = MIN_BUFFER_SIZE << i;
+        while (chain_cache[i].head && chain_cache[i].count * size > bytes) {
+            buf_chain_t *chain = chain_cache[i].head;
+            chain_cache[i].head = chain->next;
+            chain_cache[i].count--;
+            cache_stat.cached--;
+            cache_stat.cached_bytes -= size;
+            free(chain);
+        }
+    }
+}
+
+buffer_cache_stat_t *buffer_cache_stat(void) {
+    return &cache_stat;
+}
+
 static buf_chain_t **
 free_empty_chains(buffer_t *buf) {
     buf_chain_t **ch = buf->last_with_datap;
@@ -147,7 +214,7 @@ buffer_expand(buffer_t *buf, uint32_t datlen) {
             buf->last = tmp;
 
         tmp->next = chain->next;
-        free(chain);
+        buf_chain_free(chain);
         goto ok;
     }
 insert_new:
@@ -166,6 +233,74 @@ uint8_t* buffer_available_chunk(buffer_t *buf, uint32_t datlen) {
     return chain->buffer + chain->misalign + chain->off;
 }
 
+uint8_t *buffer_reserve(buffer_t *buf, uint32_t datlen, uint32_t *space) {
+    if (datlen > BUFFER_CHAIN_MAX_AUTO_SIZE)
+        datlen = BUFFER_CHAIN_MAX_AUTO_SIZE;
+    buf_chain_t *chain = buffer_expand(buf, datlen);
+    if (chain == NULL)
+        return NULL;
+    *space = CHAIN_SPACE_LEN(chain);
+    return chain->buffer + chain->misalign + chain->off;
+}
+
+int buffer_commit(buffer_t *buf, uint8_t *data, uint32_t n) {
+    buf_chain_t **chp;
+    if (n == 0)
+        return 0;
+    if (n > BUFFER_CHAIN_MAX - buf->total_len)
+        return -1;
+    // the reserved space is in the last chain with data or an empty one after it
+    for (chp = buf->last_with_datap; *chp; chp = &(*chp)->next) {
+        buf_chain_t *chain = *chp;
+        if (chain->buffer + chain->misalign + chain->off != data)
+            continue;
+        if (n > CHAIN_SPACE_LEN(chain))
+            return -1;
+        chain->off += n;
+        buf->total_len += n;
+        buf->last_with_datap = chp;
+        return 0;
+    }
+    return -1;
+}
+
+int buffer_reserve_iov(buffer_t *buf, uint32_t datlen, struct iovec *iov) {
+    buf_chain_t *chain = *buf->last_with_datap;
+    uint32_t space = chain ? CHAIN_SPACE_LEN(chain) : 0;
+    if (datlen > BUFFER_CHAIN_MAX_AUTO_SIZE)
+        datlen = BUFFER_CHAIN_MAX_AUTO_SIZE;
+    if (chain == NULL || chain->off == 0 || space == 0 || space >= datlen) {
+        iov[0].iov_base = buffer_reserve(buf, datlen, &space);
+        iov[0].iov_len = space;
+        return iov[0].iov_base ? 1 : 0;
+    }
+    // the tail is too small: read into it first and spill into a new chain
+    buf_chain_t *next = chain->next;
+    if (next == NULL || CHAIN_SPACE_LEN(next) < datlen - space) {
+        next = buf_chain_new(datlen - space);
+        if (next == NULL)
+            return 0;
+        buf_chain_free_all(chain->next);
+        chain->next = next;
+        buf->last = next;
+    }
+    iov[0].iov_base = chain->buffer + chain->misalign + chain->off;
+    iov[0].iov_len = space;
+    iov[1].iov_base = next->buffer + next->misalign + next->off;
+    iov[1].iov_len = CHAIN_SPACE_LEN(next);
+    return 2;
+}
+
+int buffer_commit_iov(buffer_t *buf, struct iovec *iov, int cnt, uint32_t n) {
+    for (int i = 0; i < cnt && n > 0; i++) {
+        uint32_t c = n < iov[i].iov_len ? n : iov[i].iov_len;
+        if (buffer_commit(buf, iov[i].iov_base, c) < 0)
+            return -1;
+        n -= c;
+    }
+    return 0;
+}
+
 int buffer_add(buffer_t *buf, const void *data_in, uint32_t datlen) {
     buf_chain_t *chain, *tmp;
     const uint8_t *data = data_in;
@@ -231,8 +366,7 @@ done:
     return result;
 }
 
-static uint32_t
-buf_copyout(buffer_t *buf, void *data_out, uint32_t datlen) {
+uint32_t buffer_copyout(buffer_t *buf, void *data_out, uint32_t datlen) {
     buf_chain_t *chain;
     char *data = data_out;
     uint32_t nread;
@@ -261,7 +395,7 @@ buf_copyout(buffer_t *buf, void *data_out, uint32_t datlen) {
 }
 
 int buffer_remove(buffer_t *buf, void *data_out, uint32_t datlen) {
-    uint32_t n = buf_copyout(buf, data_out, datlen);
+    uint32_t n = buffer_copyout(buf, data_out, datlen);
     if (n > 0) {
         if (buffer_drain(buf, n) < 0)
             n = -1;
@@ -288,7 +422,7 @@ int buffer_drain(buffer_t *buf, uint32_t len) {
         len = old_len;
         for (chain = buf->first; chain != NULL; chain = next) {
             next = chain->next;
-            free(chain);
+            buf_chain_free(chain);
         }
         ZERO_CHAIN(buf);
     } else {
@@ -304,7 +438,7 @@ int buffer_drain(buffer_t *buf, uint32_t len) {
             if (&chain->next == buf->last_with_datap)
                 buf->last_with_datap = &buf->first;
 
-            free(chain);
+            buf_chain_free(chain);
         }
 
         buf->first = chain;
@@ -335,42 +469,53 @@ check_sep(buf_chain_t * chain, int from, const char *sep, int seplen) {
     }
 }
 
+// memchr (vectorized by libc) jumps to the next candidate first byte of
+// each chain, check_sep confirms it, also across chains. last_read_pos
+// remembers where a failed search stopped so data is only scanned once
 int buffer_search(buffer_t *buf, const char* sep, const int seplen) {
     buf_chain_t *chain;
-    int i;
-    chain = buf->first;
-    if (chain == NULL)
+    uint32_t base = 0;
+    if (seplen <= 0 || buf->total_len < (uint32_t)seplen)
         return 0;
-    int bytes = chain->off;
-    while (bytes <= buf->last_read_pos) {
+    // last position a separator can start at
+    uint32_t last = buf->total_len - seplen;
+    uint32_t pos = buf->last_read_pos;
+    if (pos > last)
+        return 0;
+    chain = buf->first;
+    while (base + chain->off <= pos) {
+        base += chain->off;
         chain = chain->next;
-        if (chain == NULL)
-            return 0;
-        bytes += chain->off;
-    }
-    bytes -= buf->last_read_pos;
-    int from = chain->off - bytes;
-    for (i = buf->last_read_pos; i <= buf->total_len - seplen; i++) {
-        if (check_sep(chain, from, sep, seplen)) {
-            buf->last_read_pos = 0;
-            return i+seplen;
-        }
-        ++from;
-        --bytes;
-        if (bytes == 0) {
-            chain = chain->next;
-            from = 0;
-            if (chain == NULL)
+    }
+    for (; chain && base <= last; base += chain->off, chain = chain->next) {
+        const uint8_t *data = chain->buffer + chain->misalign;
+        uint32_t from = pos - base;
+        uint32_t end = chain->off;
+        if (base + end > last + 1)
+            end = last + 1 - base;
+        while (from < end) {
+            const uint8_t *hit = memchr(data + from, (uint8_t)sep[0], end - from);
+            if (hit == NULL)
                 break;
-            bytes = chain->off;
+            from = hit - data;
+            if (check_sep(chain, from, sep, seplen)) {
+                buf->last_read_pos = 0;
+                return base + from + seplen;
+            }
+            ++from;
         }
+        pos = base + chain->off;
     }
-    buf->last_read_pos = i;
+    buf->last_read_pos = last + 1;
     return 0;
 }
 
 
 uint8_t * buffer_write_atmost(buffer_t *p) {
+    return buffer_pullup(p, p->total_len);
+}
+
+uint8_t * buffer_pullup(buffer_t *p, uint32_t size) {
     buf_chain_t *chain, *next, *tmp, *last_with_data;
     uint8_t *buffer;
     uint32_t remaining;
@@ -378,7 +523,8 @@ uint8_t * buffer_write_atmost(buffer_t *p) {
     int removed_last_with_datap = 0;
 
     chain = p->first;
-    uint32_t size = p->total_len;
+    if (chain == NULL || size == 0 || size > p->total_len)
+        return NULL;
 
     if (chain->off >= size) {
         return chain->buffer + chain->misalign;
@@ -421,7 +567,7 @@ uint8_t * buffer_write_atmost(buffer_t *p) {
         if (&chain->next == p->last_with_datap)
             removed_last_with_datap = 1;
 
-        free(chain);
+        buf_chain_free(chain);
     }
 
     if (chain != NULL) {
@@ -444,3 +590,19 @@ uint8_t * buffer_write_atmost(buffer_t *p) {
     }
     return tmp->buffer + tmp->misalign;
 }
+
+int buffer_peek_iov(buffer_t *buf, struct iovec *iov, int max, uint32_t *bytes) {
+    buf_chain_t *chain;
+    int n = 0;
+    uint32_t total = 0;
+    for (chain = buf->first; chain && n < max; chain = chain->next) {
+        if (chain->off == 0)
+            continue;
+        iov[n].iov_base = chain->buffer + chain->misalign;
+        iov[n].iov_len = chain->off;
+        total += chain->off;
+        n++;
+    }
+    *bytes = total;
+    return n;
+}
@@ -1,6 +1,7 @@
 #ifndef buffer_h
 #define buffer_h
 #include <stdint.h>
+#include <sys/uio.h>
 
 // Structure representing a chain of buffers
 typedef struct buf_chain_s {
@@ -18,14 +19,44 @@ typedef struct buffer_s {
     buf_chain_t **last_with_datap; // Pointer to the last buffer chain with data
     uint32_t total_len;            // Total length of data in the buffer
     uint32_t last_read_pos;        // Position of the last read (for separated reads)
+    uint32_t high_wm;              // Write backpressure above this many bytes, 0 for none
+    uint32_t low_wm;               // ... until drained down to this many
+    int over_wm;                   // Crossed high_wm and not yet back to low_wm
 } buffer_t;
 
+// Chains of 1K to 64K are recycled through per-thread, per-size freelists
+typedef struct {
+    uint64_t hits;          // chains taken from the cache
+    uint64_t misses;        // chains that had to be malloc'd
+    uint64_t releases;      // chains freed because their class was full or too big
+    uint32_t cached;        // chains in the cache now
+    uint64_t cached_bytes;
+} buffer_cache_stat_t;
+
 // Returns a pointer to a chunk of available data in the buffer
 uint8_t* buffer_available_chunk(buffer_t *buf, uint32_t datlen);
 
 // Adds data to the buffer
 int buffer_add(buffer_t *buf, const void *data, uint32_t datlen);
 
+// Reserves contiguous space for up to datlen (at most 4096) bytes at the tail
+// and returns where to write, *space gets its size. The bytes only become
+// part of the buffer with buffer_commit, so they are written exactly once
+uint8_t *buffer_reserve(buffer_t *buf, uint32_t datlen, uint32_t *space);
+
+// Adds n bytes written at data, a pointer returned by buffer_reserve(_iov)
+int buffer_commit(buffer_t *buf, uint8_t *data, uint32_t n);
+
+// Like buffer_reserve for a readv: the space left in the tail chain plus a
+// fresh chain for the rest, returns the number of iovecs (1 or 2), 0 on failure
+int buffer_reserve_iov(buffer_t *buf, uint32_t datlen, struct iovec *iov);
+
+// Commits n bytes read into the iovecs of buffer_reserve_iov
+int buffer_commit_iov(buffer_t *buf, struct iovec *iov, int cnt, uint32_t n);
+
+// Copies up to datlen bytes from the front without removing them, returns the count
+uint32_t buffer_copyout(buffer_t *buf, void *data, uint32_t datlen);
+
 // Removes data from the buffer
 int buffer_remove(buffer_t *buf, void *data, uint32_t datlen);
 
@@ -35,10 +66,24 @@ int buffer_drain(buffer_t *buf, uint32_t len);
 // Frees all buffer chains
 void buf_chain_free_all(buf_chain_t *chain);
 
+// Bytes each size class of this thread's cache may hold, 0 disables it
+void buffer_cache_limit(uint32_t bytes);
+
+// This thread's cache counters
+buffer_cache_stat_t *buffer_cache_stat(void);
+
 // Searches for a separator in the buffer
 int buffer_search(buffer_t *buf, const char* sep, const int seplen);
 
 // Writes data to the buffer, up to a maximum length
 uint8_t * buffer_write_atmost(buffer_t *p);
 
+// Makes the first size bytes contiguous, moving as few chains as possible.
+// Returns them, or NULL if fewer are buffered
+uint8_t * buffer_pullup(buffer_t *p, uint32_t size);
+
+// Fills up to max iovecs with the data chains, in order, without copying.
+// Returns the number filled, *bytes gets the bytes they cover
+int buffer_peek_iov(buffer_t *buf, struct iovec *iov, int max, uint32_t *bytes);
+
 #endif
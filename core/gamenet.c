@@ -1,5 +1,9 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <luajit.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -9,6 +13,16 @@ typedef struct {
     size_t mem_level;
 } lstate_t;
 
+// 每个线程一个独立的lua虚拟机和事件循环
+typedef struct {
+    int id;             // 1..nthread
+    int nthread;
+    int cpu;            // 绑定的cpu，-1表示不绑定
+    const char *file;
+    lstate_t ud;
+    int ret;
+} worker_t;
+
 const size_t MEMLVL = 2097152; // 2M
 const size_t MEM_1MB = 1048576; // 1M
 
@@ -32,13 +46,13 @@ lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
         do {
             s->mem_level += MEMLVL;
         } while (s->mem > s->mem_level);
-        
+
         printf("luajit vm now use %.2f M's memory up\n", (float)s->mem / MEM_1MB);
     } else if (s->mem < s->mem_level - MEMLVL) {
         do {
             s->mem_level -= MEMLVL;
         } while (s->mem < s->mem_level);
-        
+
         printf("luajit vm now use %.2f M's memory down\n", (float)s->mem / MEM_1MB);
     }
     if (nsize == 0) {
@@ -49,28 +63,114 @@ lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
     }
 }
 
-int main(int argc, char** argv) {
-    lstate_t ud = {0, MEMLVL};
-    lua_State *L = lua_newstate(lua_alloc, &ud);
+static int
+bind_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static int
+run_lua(worker_t *w) {
+    if (w->cpu >= 0 && bind_cpu(w->cpu) != 0) {
+        fprintf(stderr, "thread %d can't bind cpu %d\n", w->id, w->cpu);
+    }
+    w->ud.mem = 0;
+    w->ud.mem_level = MEMLVL;
+    lua_State *L = lua_newstate(lua_alloc, &w->ud);
     luaL_openlibs(L);
-    if (argc > 1) {
-        lua_pushcfunction(L, traceback);
-        int r = luaL_loadfile(L, argv[1]);
-        lua_pushlightuserdata(L, NULL);
-        lua_setglobal(L, "null");
-        if (LUA_OK != r) {
-            const char* err = lua_tostring(L, -1);
-            fprintf(stderr, "can't load %s err:%s\n", argv[1], err);
-            return 1;
-        }
-        r = lua_pcall(L, 0, LUA_MULTRET, 1);
-        if (LUA_OK != r) {
-            const char* err = lua_tostring(L, -1);
-            fprintf(stderr, "lua file %s launch err:%s\n", argv[1], err);
+    lua_pushcfunction(L, traceback);
+    int r = luaL_loadfile(L, w->file);
+    lua_pushlightuserdata(L, NULL);
+    lua_setglobal(L, "null");
+    lua_pushinteger(L, w->id);
+    lua_setglobal(L, "GAMENET_THREAD");
+    lua_pushinteger(L, w->nthread);
+    lua_setglobal(L, "GAMENET_NTHREAD");
+    if (LUA_OK != r) {
+        const char* err = lua_tostring(L, -1);
+        fprintf(stderr, "can't load %s err:%s\n", w->file, err);
+        return 1;
+    }
+    r = lua_pcall(L, 0, LUA_MULTRET, 1);
+    if (LUA_OK != r) {
+        const char* err = lua_tostring(L, -1);
+        fprintf(stderr, "lua file %s launch err:%s\n", w->file, err);
+        return 1;
+    }
+    return 0;
+}
+
+static void *
+worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    w->ret = run_lua(w);
+    return NULL;
+}
+
+static void
+usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t nthread] [-a] main.lua\n"
+        "  -t nthread  run nthread event loops, one lua vm per thread\n"
+        "  -a          bind the i-th loop thread to cpu i\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int nthread = 1, affinity = 0, opt;
+    while ((opt = getopt(argc, argv, "t:a")) != -1) {
+        switch (opt) {
+        case 't':
+            nthread = atoi(optarg);
+            break;
+        case 'a':
+            affinity = 1;
+            break;
+        default:
+            usage(argv[0]);
             return 1;
         }
-    } else {
+    }
+    if (optind >= argc) {
         fprintf(stderr, "please provide main lua file\n");
+        return 0;
     }
-    return 0;
+    if (nthread < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+
+    worker_t *workers = calloc(nthread, sizeof(worker_t));
+    for (int i = 0; i < nthread; i++) {
+        workers[i].id = i + 1;
+        workers[i].nthread = nthread;
+        workers[i].cpu = affinity ? (int)(i % ncpu) : -1;
+        workers[i].file = argv[optind];
+    }
+    if (nthread == 1) {
+        int ret = run_lua(&workers[0]);
+        free(workers);
+        return ret;
+    }
+
+    pthread_t *tids = calloc(nthread, sizeof(pthread_t));
+    int started = 0;
+    for (int i = 0; i < nthread; i++) {
+        if (pthread_create(&tids[i], NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "can't create thread %d\n", i + 1);
+            break;
+        }
+        started++;
+    }
+    int ret = started == nthread ? 0 : 1;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        if (workers[i].ret)
+            ret = workers[i].ret;
+    }
+    free(tids);
+    free(workers);
+    return ret;
 }
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include "resolver.h"
+
+// a slow or timed out lookup only holds up its own thread
+#define RESOLVER_THREADS 4
+
+typedef struct job_s {
+    struct job_s *next;
+    resolver_result_t res;
+    char host[];
+} job_t;
+
+typedef struct {
+    job_t *head;
+    job_t *tail;
+} job_queue_t;
+
+struct resolver_s {
+    pthread_t threads[RESOLVER_THREADS];
+    int nthread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int efd;
+    int stop;
+    job_queue_t pending;
+    job_queue_t done;
+};
+
+static void
+queue_push(job_queue_t *q, job_t *job) {
+    job->next = NULL;
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+}
+
+static job_t *
+queue_pop(job_queue_t *q) {
+    job_t *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    return job;
+}
+
+static void
+queue_free(job_queue_t *q) {
+    job_t *job;
+    while ((job = queue_pop(q)) != NULL)
+        free(job);
+}
+
+static void
+notify(resolver_t *r) {
+    uint64_t one = 1;
+    ssize_t n = write(r->efd, &one, sizeof(one));
+    (void)n;
+}
+
+static void
+lookup(job_t *job) {
+    struct addrinfo hints, *info, *p;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    int err = getaddrinfo(job->host, NULL, &hints, &info);
+    if (err != 0) {
+        job->res.err = err;
+        return;
+    }
+    // most services still listen on v4 only
+    struct addrinfo *pick = info;
+    for (p = info; p; p = p->ai_next) {
+        if (p->ai_family == AF_INET) {
+            pick = p;
+            break;
+        }
+    }
+    if (pick->ai_family == AF_INET)
+        inet_ntop(AF_INET, &((struct sockaddr_in *)pick->ai_addr)->sin_addr,
+            job->res.ip, sizeof(job->res.ip));
+    else
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *)pick->ai_addr)->sin6_addr,
+            job->res.ip, sizeof(job->res.ip));
+    freeaddrinfo(info);
+}
+
+static void *
+resolver_main(void *arg) {
+    resolver_t *r = (resolver_t *)arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->stop && r->pending.head == NULL)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stop)
+            break;
+        job_t *job = queue_pop(&r->pending);
+        pthread_mutex_unlock(&r->lock);
+        lookup(job);
+        pthread_mutex_lock(&r->lock);
+        queue_push(&r->done, job);
+        notify(r);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+resolver_t *
+resolver_create(void) {
+    resolver_t *r = calloc(1, sizeof(resolver_t));
+    if (r == NULL)
+        return NULL;
+    r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->efd < 0) {
+        free(r);
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    // fewer threads than asked for still resolve, just with less overlap
+    while (r->nthread < RESOLVER_THREADS
+        && pthread_create(&r->threads[r->nthread], NULL, resolver_main, r) == 0)
+        r->nthread++;
+    if (r->nthread == 0) {
+        close(r->efd);
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->cond);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// a lookup in progress still has to time out inside getaddrinfo
+void
+resolver_free(resolver_t *r) {
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    for (int i = 0; i < r->nthread; i++)
+        pthread_join(r->threads[i], NULL);
+    queue_free(&r->pending);
+    queue_free(&r->done);
+    close(r->efd);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r);
+}
+
+int
+resolver_fd(resolver_t *r) {
+    return r->efd;
+}
+
+int
+resolver_query(resolver_t *r, const char *host, int id) {
+    size_t len = strlen(host);
+    job_t *job = malloc(sizeof(job_t) + len + 1);
+    if (job == NULL)
+        return -1;
+    memset(&job->res, 0, sizeof(job->res));
+    job->res.id = id;
+    memcpy(job->host, host, len + 1);
+    pthread_mutex_lock(&r->lock);
+    queue_push(&r->pending, job);
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+int
+resolver_results(resolver_t *r, resolver_result_t *out, int max) {
+    uint64_t cnt;
+    ssize_t rn = read(r->efd, &cnt, sizeof(cnt));
+    (void)rn;
+    int n = 0;
+    pthread_mutex_lock(&r->lock);
+    job_t *job;
+    while (n < max && (job = queue_pop(&r->done)) != NULL) {
+        out[n++] = job->res;
+        free(job);
+    }
+    // keep the eventfd readable for what didn't fit
+    if (r->done.head)
+        notify(r);
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
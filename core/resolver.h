@@ -0,0 +1,31 @@
+#ifndef resolver_h
+#define resolver_h
+#include <netinet/in.h>
+
+// Hostname lookups on a few helper threads so that getaddrinfo never blocks an
+// event loop, and one slow lookup doesn't hold up the others behind it.
+// Finished lookups are signalled through an eventfd the loop polls.
+typedef struct resolver_s resolver_t;
+
+typedef struct {
+    int id;                         // the id passed to resolver_query
+    int err;                        // getaddrinfo error, 0 on success
+    char ip[INET6_ADDRSTRLEN];      // first address, v4 preferred
+} resolver_result_t;
+
+// Starts the lookup threads, NULL on failure
+resolver_t *resolver_create(void);
+
+// Stops the threads and drops pending lookups
+void resolver_free(resolver_t *r);
+
+// Readable while finished lookups are waiting for resolver_results
+int resolver_fd(resolver_t *r);
+
+// Queues a lookup of host, returns -1 on failure
+int resolver_query(resolver_t *r, const char *host, int id);
+
+// Takes up to max finished lookups, returns the number taken
+int resolver_results(resolver_t *r, resolver_result_t *out, int max);
+
+#endif
@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rudp.h"
+
+#define RUDP_CMD_PUSH 1
+#define RUDP_CMD_ACK 2
+#define RUDP_CMD_FIN 3
+
+#define TIME_DIFF(a, b) ((int32_t)((a) - (b)))
+
+typedef struct list_s {
+    struct list_s *prev;
+    struct list_s *next;
+} list_t;
+
+typedef struct {
+    list_t node;                // first, a list_t * is a seg_t *
+    uint32_t sn;
+    uint32_t ts;                // time of the last transmission
+    uint32_t resendts;
+    uint32_t rto;
+    uint32_t fastack;           // acks of later segments since the last send
+    uint32_t xmit;
+    uint32_t len;
+    char data[];
+} seg_t;
+
+struct rudp_s {
+    uint32_t conv;
+    uint32_t mtu;
+    uint32_t mss;
+    uint32_t snd_una;           // first unacked sn
+    uint32_t snd_nxt;
+    uint32_t rcv_nxt;
+    uint32_t snd_wnd;
+    uint32_t rcv_wnd;
+    uint32_t rmt_wnd;
+    int32_t srtt;
+    int32_t rttvar;
+    int32_t rto;
+    int32_t minrto;
+    uint32_t interval;
+    uint32_t fastresend;
+    int nodelay;
+    int state;
+    int fin_rcvd;
+    uint32_t fin_sn;            // sn after the peer's last segment
+    uint32_t nsnd_que;
+    uint32_t nsnd_buf;
+    uint32_t nrcv_que;
+    uint32_t nrcv_buf;
+    uint32_t rcv_off;           // bytes of the first rcv_queue segment already read
+    int readable;
+    list_t snd_queue;           // not sent yet
+    list_t snd_buf;             // in flight, sorted by sn
+    list_t rcv_buf;             // out of order, sorted by sn
+    list_t rcv_queue;           // in order, waiting for rudp_recv
+    uint32_t *acklist;          // sn, ts pairs to ack on the next update
+    uint32_t ackcount;
+    uint32_t ackcap;
+    char *buffer;
+    rudp_output output;
+    void *ud;
+    rudp_stat_t stat;
+};
+
+static inline void
+list_init(list_t *head) {
+    head->prev = head->next = head;
+}
+
+static inline int
+list_empty(list_t *head) {
+    return head->next == head;
+}
+
+static inline void
+list_add_after(list_t *pos, list_t *node) {
+    node->prev = pos;
+    node->next = pos->next;
+    pos->next->prev = node;
+    pos->next = node;
+}
+
+static inline void
+list_add_tail(list_t *head, list_t *node) {
+    list_add_after(head->prev, node);
+}
+
+static inline void
+list_del(list_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static void
+list_free(list_t *head) {
+    while (!list_empty(head)) {
+        list_t *node = head->next;
+        list_del(node);
+        free(node);
+    }
+}
+
+static inline char *
+enc16(char *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline char *
+enc32(char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+static inline uint16_t
+dec16(const char *p) {
+    const uint8_t *u = (const uint8_t *)p;
+    return u[0] | (u[1] << 8);
+}
+
+static inline uint32_t
+dec32(const char *p) {
+    const uint8_t *u = (const uint8_t *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static char *
+encode_seg(rudp_t *r, char *p, uint8_t cmd, uint32_t ts, uint32_t sn, uint32_t len) {
+    uint32_t wnd = r->rcv_wnd > r->nrcv_que ? r->rcv_wnd - r->nrcv_que : 0;
+    p = enc32(p, r->conv);
+    *p++ = cmd;
+    p = enc16(p, wnd);
+    p = enc32(p, ts);
+    p = enc32(p, sn);
+    p = enc32(p, r->rcv_nxt);
+    return enc16(p, len);
+}
+
+static seg_t *
+seg_new(uint32_t cap) {
+    seg_t *seg = malloc(sizeof(seg_t) + cap);
+    if (seg)
+        memset(seg, 0, sizeof(seg_t));
+    return seg;
+}
+
+rudp_t *
+rudp_create(uint32_t conv, rudp_output output, void *ud) {
+    rudp_t *r = calloc(1, sizeof(rudp_t));
+    if (r == NULL)
+        return NULL;
+    r->conv = conv;
+    r->mtu = RUDP_MTU;
+    r->mss = RUDP_MTU - RUDP_OVERHEAD;
+    r->snd_wnd = r->rcv_wnd = r->rmt_wnd = RUDP_WND;
+    r->rto = RUDP_RTO_DEF;
+    r->minrto = RUDP_RTO_MIN;
+    r->interval = RUDP_INTERVAL;
+    r->fastresend = RUDP_FASTRESEND;
+    r->output = output;
+    r->ud = ud;
+    list_init(&r->snd_queue);
+    list_init(&r->snd_buf);
+    list_init(&r->rcv_buf);
+    list_init(&r->rcv_queue);
+    r->buffer = malloc(r->mtu);
+    if (r->buffer == NULL) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void
+rudp_free(rudp_t *r) {
+    list_free(&r->snd_queue);
+    list_free(&r->snd_buf);
+    list_free(&r->rcv_buf);
+    list_free(&r->rcv_queue);
+    free(r->acklist);
+    free(r->buffer);
+    free(r);
+}
+
+void
+rudp_config(rudp_t *r, int interval, int minrto, int fastresend, int nodelay) {
+    if (interval > 0)
+        r->interval = interval;
+    if (minrto > 0)
+        r->minrto = minrto;
+    if (fastresend >= 0)
+        r->fastresend = fastresend;
+    if (nodelay >= 0)
+        r->nodelay = nodelay;
+    if (r->rto < r->minrto)
+        r->rto = r->minrto;
+}
+
+void
+rudp_wndsize(rudp_t *r, int sndwnd, int rcvwnd) {
+    if (sndwnd > 0)
+        r->snd_wnd = sndwnd;
+    if (rcvwnd > 0)
+        r->rcv_wnd = rcvwnd;
+}
+
+// only before any data is queued, segments are allocated with the mss
+int
+rudp_setmtu(rudp_t *r, int mtu) {
+    if (mtu <= RUDP_OVERHEAD + 32 || r->nsnd_que || r->nsnd_buf)
+        return -1;
+    char *buffer = realloc(r->buffer, mtu);
+    if (buffer == NULL)
+        return -1;
+    r->buffer = buffer;
+    r->mtu = mtu;
+    r->mss = mtu - RUDP_OVERHEAD;
+    return 0;
+}
+
+int
+rudp_send(rudp_t *r, const char *data, int len) {
+    // stream mode, top up the last queued segment first
+    if (!list_empty(&r->snd_queue)) {
+        seg_t *last = (seg_t *)r->snd_queue.prev;
+        if (last->len < r->mss) {
+            int n = r->mss - last->len;
+            if (n > len)
+                n = len;
+            memcpy(last->data + last->len, data, n);
+            last->len += n;
+            data += n;
+            len -= n;
+        }
+    }
+    while (len > 0) {
+        int n = len < (int)r->mss ? len : (int)r->mss;
+        seg_t *seg = seg_new(r->mss);
+        if (seg == NULL)
+            return -1;
+        memcpy(seg->data, data, n);
+        seg->len = n;
+        list_add_tail(&r->snd_queue, &seg->node);
+        r->nsnd_que++;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void
+update_rtt(rudp_t *r, int32_t rtt) {
+    if (r->srtt == 0) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+    } else {
+        int32_t delta = rtt > r->srtt ? rtt - r->srtt : r->srtt - rtt;
+        r->rttvar = (3 * r->rttvar + delta) / 4;
+        r->srtt = (7 * r->srtt + rtt) / 8;
+        if (r->srtt < 1)
+            r->srtt = 1;
+    }
+    int32_t var = 4 * r->rttvar;
+    int32_t rto = r->srtt + (var > (int32_t)r->interval ? var : (int32_t)r->interval);
+    if (rto < r->minrto)
+        rto = r->minrto;
+    if (rto > RUDP_RTO_MAX)
+        rto = RUDP_RTO_MAX;
+    r->rto = rto;
+}
+
+static void
+shrink_buf(rudp_t *r) {
+    if (list_empty(&r->snd_buf))
+        r->snd_una = r->snd_nxt;
+    else
+        r->snd_una = ((seg_t *)r->snd_buf.next)->sn;
+}
+
+// everything before una arrived
+static void
+parse_una(rudp_t *r, uint32_t una) {
+    while (!list_empty(&r->snd_buf)) {
+        seg_t *seg = (seg_t *)r->snd_buf.next;
+        if (TIME_DIFF(una, seg->sn) <= 0)
+            break;
+        list_del(&seg->node);
+        free(seg);
+        r->nsnd_buf--;
+    }
+}
+
+// selective ack of one segment
+static void
+parse_ack(rudp_t *r, uint32_t sn) {
+    if (TIME_DIFF(sn, r->snd_una) < 0 || TIME_DIFF(sn, r->snd_nxt) >= 0)
+        return;
+    for (list_t *p = r->snd_buf.next; p != &r->snd_buf; p = p->next) {
+        seg_t *seg = (seg_t *)p;
+        if (seg->sn == sn) {
+            list_del(p);
+            free(seg);
+            r->nsnd_buf--;
+            break;
+        }
+        if (TIME_DIFF(sn, seg->sn) < 0)
+            break;
+    }
+}
+
+// segments older than the newest ack were skipped by the peer
+static void
+parse_fastack(rudp_t *r, uint32_t maxack) {
+    for (list_t *p = r->snd_buf.next; p != &r->snd_buf; p = p->next) {
+        seg_t *seg = (seg_t *)p;
+        if (TIME_DIFF(maxack, seg->sn) <= 0)
+            break;
+        seg->fastack++;
+    }
+}
+
+static int
+ack_push(rudp_t *r, uint32_t sn, uint32_t ts) {
+    if (r->ackcount == r->ackcap) {
+        uint32_t cap = r->ackcap ? r->ackcap * 2 : 16;
+        uint32_t *list = realloc(r->acklist, cap * 2 * sizeof(uint32_t));
+        if (list == NULL)
+            return -1;
+        r->acklist = list;
+        r->ackcap = cap;
+    }
+    r->acklist[r->ackcount * 2] = sn;
+    r->acklist[r->ackcount * 2 + 1] = ts;
+    r->ackcount++;
+    return 0;
+}
+
+// the fin only counts once every segment before it is in order
+static void
+check_fin(rudp_t *r) {
+    if (r->fin_rcvd && r->state == RUDP_OK && TIME_DIFF(r->rcv_nxt, r->fin_sn) >= 0)
+        r->state = RUDP_FIN;
+}
+
+// move the in-order head of rcv_buf to rcv_queue
+static void
+move_rcv(rudp_t *r) {
+    while (!list_empty(&r->rcv_buf) && r->nrcv_que < r->rcv_wnd) {
+        seg_t *seg = (seg_t *)r->rcv_buf.next;
+        if (seg->sn != r->rcv_nxt)
+            break;
+        list_del(&seg->node);
+        r->nrcv_buf--;
+        list_add_tail(&r->rcv_queue, &seg->node);
+        r->nrcv_que++;
+        r->readable += seg->len;
+        r->rcv_nxt++;
+    }
+    check_fin(r);
+}
+
+static int
+parse_data(rudp_t *r, uint32_t sn, const char *data, uint32_t len) {
+    if (TIME_DIFF(sn, r->rcv_nxt + r->rcv_wnd) >= 0 || TIME_DIFF(sn, r->rcv_nxt) < 0) {
+        r->stat.dup_segs++;
+        return 0;
+    }
+    list_t *p;
+    for (p = r->rcv_buf.prev; p != &r->rcv_buf; p = p->prev) {
+        seg_t *seg = (seg_t *)p;
+        if (seg->sn == sn) {
+            r->stat.dup_segs++;
+            return 0;
+        }
+        if (TIME_DIFF(sn, seg->sn) > 0)
+            break;
+    }
+    seg_t *seg = seg_new(len);
+    if (seg == NULL)
+        return -1;
+    seg->sn = sn;
+    seg->len = len;
+    memcpy(seg->data, data, len);
+    list_add_after(p, &seg->node);
+    r->nrcv_buf++;
+    move_rcv(r);
+    return 0;
+}
+
+int
+rudp_input(rudp_t *r, const char *data, int len, uint32_t now) {
+    int acked = 0;
+    uint32_t maxack = 0;
+    if (len < RUDP_OVERHEAD)
+        return -1;
+    while (len >= RUDP_OVERHEAD) {
+        uint32_t conv = dec32(data);
+        uint8_t cmd = data[4];
+        uint16_t wnd = dec16(data + 5);
+        uint32_t ts = dec32(data + 7);
+        uint32_t sn = dec32(data + 11);
+        uint32_t una = dec32(data + 15);
+        uint32_t seglen = dec16(data + 19);
+        if (conv != r->conv)
+            return -1;
+        if ((uint32_t)len - RUDP_OVERHEAD < seglen)
+            return -2;
+        data += RUDP_OVERHEAD;
+        len -= RUDP_OVERHEAD;
+        r->rmt_wnd = wnd;
+        parse_una(r, una);
+        shrink_buf(r);
+        switch (cmd) {
+        case RUDP_CMD_ACK:
+            if (TIME_DIFF(now, ts) >= 0)
+                update_rtt(r, TIME_DIFF(now, ts));
+            parse_ack(r, sn);
+            shrink_buf(r);
+            if (!acked || TIME_DIFF(sn, maxack) > 0)
+                maxack = sn;
+            acked = 1;
+            break;
+        case RUDP_CMD_PUSH:
+            r->stat.in_segs++;
+            if (TIME_DIFF(sn, r->rcv_nxt + r->rcv_wnd) < 0) {
+                if (ack_push(r, sn, ts) < 0 || parse_data(r, sn, data, seglen) < 0)
+                    return -4;
+            }
+            break;
+        case RUDP_CMD_FIN:
+            r->fin_rcvd = 1;
+            r->fin_sn = sn;
+            check_fin(r);
+            break;
+        default:
+            return -3;
+        }
+        data += seglen;
+        len -= seglen;
+    }
+    if (acked)
+        parse_fastack(r, maxack);
+    return 0;
+}
+
+int
+rudp_recv(rudp_t *r, char *buf, int len) {
+    int n = 0;
+    while (n < len && !list_empty(&r->rcv_queue)) {
+        seg_t *seg = (seg_t *)r->rcv_queue.next;
+        uint32_t left = seg->len - r->rcv_off;
+        uint32_t copy = left < (uint32_t)(len - n) ? left : (uint32_t)(len - n);
+        memcpy(buf + n, seg->data + r->rcv_off, copy);
+        n += copy;
+        r->rcv_off += copy;
+        if (r->rcv_off == seg->len) {
+            list_del(&seg->node);
+            free(seg);
+            r->nrcv_que--;
+            r->rcv_off = 0;
+        }
+    }
+    r->readable -= n;
+    // the receive window opened again
+    move_rcv(r);
+    return n;
+}
+
+int
+rudp_readable(rudp_t *r) {
+    return r->readable;
+}
+
+static char *
+flush_buffer(rudp_t *r, char *p, uint32_t need) {
+    if ((uint32_t)(p - r->buffer) + need > r->mtu) {
+        r->output(r->buffer, p - r->buffer, r->ud);
+        return r->buffer;
+    }
+    return p;
+}
+
+void
+rudp_update(rudp_t *r, uint32_t now) {
+    char *p = r->buffer;
+    for (uint32_t i = 0; i < r->ackcount; i++) {
+        p = flush_buffer(r, p, RUDP_OVERHEAD);
+        p = encode_seg(r, p, RUDP_CMD_ACK, r->acklist[i * 2 + 1], r->acklist[i * 2], 0);
+    }
+    r->ackcount = 0;
+
+    uint32_t cwnd = r->snd_wnd < r->rmt_wnd ? r->snd_wnd : r->rmt_wnd;
+    // the peer window is closed, probe it with one segment
+    if (cwnd == 0 && r->nsnd_buf == 0)
+        cwnd = 1;
+    while (TIME_DIFF(r->snd_nxt, r->snd_una + cwnd) < 0 && !list_empty(&r->snd_queue)) {
+        seg_t *seg = (seg_t *)r->snd_queue.next;
+        list_del(&seg->node);
+        r->nsnd_que--;
+        list_add_tail(&r->snd_buf, &seg->node);
+        r->nsnd_buf++;
+        seg->sn = r->snd_nxt++;
+        seg->xmit = 0;
+        seg->fastack = 0;
+    }
+
+    for (list_t *l = r->snd_buf.next; l != &r->snd_buf; l = l->next) {
+        seg_t *seg = (seg_t *)l;
+        if (seg->xmit == 0) {
+            seg->rto = r->rto;
+        } else if (TIME_DIFF(now, seg->resendts) >= 0) {
+            seg->rto += r->nodelay ? seg->rto / 2 : seg->rto;
+            if (seg->rto > RUDP_RTO_MAX)
+                seg->rto = RUDP_RTO_MAX;
+            r->stat.retrans++;
+        } else if (r->fastresend && seg->fastack >= r->fastresend) {
+            r->stat.fast_retrans++;
+        } else {
+            continue;
+        }
+        seg->xmit++;
+        seg->fastack = 0;
+        seg->ts = now;
+        seg->resendts = now + seg->rto;
+        p = flush_buffer(r, p, RUDP_OVERHEAD + seg->len);
+        p = encode_seg(r, p, RUDP_CMD_PUSH, now, seg->sn, seg->len);
+        memcpy(p, seg->data, seg->len);
+        p += seg->len;
+        r->stat.out_segs++;
+        if (seg->xmit >= RUDP_DEAD_LINK)
+            r->state = RUDP_DEAD;
+    }
+    if (p > r->buffer)
+        r->output(r->buffer, p - r->buffer, r->ud);
+}
+
+void
+rudp_fin(rudp_t *r) {
+    // queued segments take the sns up to snd_nxt + nsnd_que
+    char *p = encode_seg(r, r->buffer, RUDP_CMD_FIN, 0, r->snd_nxt + r->nsnd_que, 0);
+    r->output(r->buffer, p - r->buffer, r->ud);
+}
+
+int
+rudp_state(rudp_t *r) {
+    return r->state;
+}
+
+int
+rudp_waitsnd(rudp_t *r) {
+    return r->nsnd_que + r->nsnd_buf;
+}
+
+int
+rudp_rto(rudp_t *r) {
+    return r->rto;
+}
+
+const rudp_stat_t *
+rudp_stat(rudp_t *r) {
+    return &r->stat;
+}
+
+uint32_t
+rudp_getconv(const char *data, int len) {
+    if (len < RUDP_OVERHEAD)
+        return 0;
+    return dec32(data);
+}
+
+int
+rudp_isfirst(const char *data, int len) {
+    while (len >= RUDP_OVERHEAD) {
+        uint32_t seglen = dec16(data + 19);
+        if (data[4] == RUDP_CMD_PUSH && dec32(data + 11) == 0)
+            return 1;
+        data += RUDP_OVERHEAD + seglen;
+        len -= RUDP_OVERHEAD + seglen;
+    }
+    return 0;
+}
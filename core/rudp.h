@@ -0,0 +1,70 @@
+#ifndef rudp_h
+#define rudp_h
+
+#include <stdint.h>
+
+// reliable ordered byte stream over udp, kcp style:
+// per segment (selective) ack, una cumulative ack, fast retransmit and rto backoff.
+// time is msec of any monotonic clock, it may wrap around uint32
+
+#define RUDP_OVERHEAD 21        // conv4 cmd1 wnd2 ts4 sn4 una4 len2
+#define RUDP_MTU 1400
+#define RUDP_WND 128            // segments
+#define RUDP_INTERVAL 10
+#define RUDP_RTO_MIN 30
+#define RUDP_RTO_DEF 200
+#define RUDP_RTO_MAX 10000
+#define RUDP_FASTRESEND 2       // acks skipping a segment before it is resent
+#define RUDP_DEAD_LINK 20       // transmissions of one segment before giving up
+
+#define RUDP_OK 0
+#define RUDP_FIN 1              // the peer closed the stream
+#define RUDP_DEAD -1            // a segment was never acked
+
+typedef struct rudp_s rudp_t;
+
+// sends one datagram of len bytes to the peer
+typedef void (*rudp_output)(const char *buf, int len, void *ud);
+
+typedef struct {
+    uint64_t out_segs;
+    uint64_t in_segs;
+    uint64_t retrans;           // timeout retransmissions
+    uint64_t fast_retrans;
+    uint64_t dup_segs;          // segments received twice
+} rudp_stat_t;
+
+rudp_t *rudp_create(uint32_t conv, rudp_output output, void *ud);
+void rudp_free(rudp_t *r);
+
+// interval: update tick, minrto: rto floor, fastresend: 0 disables it,
+// nodelay: back off rto by 1.5x instead of 2x
+void rudp_config(rudp_t *r, int interval, int minrto, int fastresend, int nodelay);
+void rudp_wndsize(rudp_t *r, int sndwnd, int rcvwnd);
+int rudp_setmtu(rudp_t *r, int mtu);
+
+// queue bytes for sending, they go out on the next rudp_update
+int rudp_send(rudp_t *r, const char *data, int len);
+// feed one datagram, returns 0 or < 0 if it isn't a valid packet of this conv
+int rudp_input(rudp_t *r, const char *data, int len, uint32_t now);
+// copy up to len in-order bytes out, returns the number copied
+int rudp_recv(rudp_t *r, char *buf, int len);
+int rudp_readable(rudp_t *r);
+// send acks, new segments and retransmissions due at now
+void rudp_update(rudp_t *r, uint32_t now);
+// send a fin to the peer, best effort, the peer turns RUDP_FIN once
+// every segment queued before it arrived
+void rudp_fin(rudp_t *r);
+
+int rudp_state(rudp_t *r);
+int rudp_waitsnd(rudp_t *r);
+int rudp_rto(rudp_t *r);
+const rudp_stat_t *rudp_stat(rudp_t *r);
+
+// conv of a datagram, 0 if it is too short to be one
+uint32_t rudp_getconv(const char *data, int len);
+// 1 if the datagram carries the first segment of a stream, a listener
+// creates connections only for these so stray late packets don't open one
+int rudp_isfirst(const char *data, int len);
+
+#endif
@@ -1,26 +1,49 @@
-#include <sys/time.h>
+#include <time.h>
 #include <stddef.h>
 #include "systime.h"
 
+static inline uint64_t
+clock_us(clockid_t id) {
+    struct timespec ts = {0};
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 uint64_t
 systime_wall() {
-    // 使用结构体初始化器，避免未初始化变量
-    struct timeval tv = {0};
-    gettimeofday(&tv, NULL);
-    // 先将秒转换为微秒，再相加，避免乘法和除法的精度损失
-    uint64_t t = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
-    // 统一单位为 100 微秒
-    t /= 10000;
-    return t;
+    // 统一单位为 10 毫秒
+    return clock_us(CLOCK_REALTIME) / 10000;
 }
 
 uint64_t
 systime_mono() {
-    struct timeval tv = {0};
-    gettimeofday(&tv, NULL);
-    // 先将秒转换为微秒，再相加，避免乘法和除法的精度损失
-    uint64_t t = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
-    // 统一单位为 100 微秒
-    t /= 10000;
-    return t;
-}
\ No newline at end of file
+    // CLOCK_MONOTONIC 不受系统时间调整(NTP)影响，单位 10 毫秒
+    return clock_us(CLOCK_MONOTONIC) / 10000;
+}
+
+uint64_t
+systime_mono_ms() {
+    return clock_us(CLOCK_MONOTONIC) / 1000;
+}
+
+uint64_t
+systime_mono_us() {
+    return clock_us(CLOCK_MONOTONIC);
+}
+
+// the coarse clock skips the vdso counter read, but with HZ=250 it only
+// moves every 4ms; msec timers can't live with that, so it is used only
+// when it ticks at least every msec
+static clockid_t coarse_id = -1;
+
+uint64_t
+systime_mono_coarse() {
+    if (coarse_id == -1) {
+        struct timespec res;
+        if (clock_getres(CLOCK_MONOTONIC_COARSE, &res) == 0 && res.tv_sec == 0 && res.tv_nsec <= 1000000)
+            coarse_id = CLOCK_MONOTONIC_COARSE;
+        else
+            coarse_id = CLOCK_MONOTONIC;
+    }
+    return clock_us(coarse_id) / 1000;
+}
@@ -3,7 +3,16 @@
 
 #include <stdint.h>
 
+// wall clock and monotonic clock in csec (10ms)
 uint64_t systime_wall();
 uint64_t systime_mono();
 
+// monotonic clock in msec / usec
+uint64_t systime_mono_ms();
+uint64_t systime_mono_us();
+
+// monotonic msec for the per-loop time cache: CLOCK_MONOTONIC_COARSE when
+// it is accurate to 1ms, CLOCK_MONOTONIC otherwise
+uint64_t systime_mono_coarse();
+
 #endif
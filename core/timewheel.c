@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include "timewheel.h"
+
+#define TW_NEAR_BITS 8
+#define TW_NEAR (1 << TW_NEAR_BITS)
+#define TW_NEAR_MASK (TW_NEAR - 1)
+#define TW_LEVEL_BITS 6
+#define TW_LEVEL (1 << TW_LEVEL_BITS)
+#define TW_LEVEL_MASK (TW_LEVEL - 1)
+#define TW_LEVELS 4
+
+// list ids: near slots, then level slots, then the immediate list
+#define TW_LIST_LEVEL(i, idx) (TW_NEAR + (i) * TW_LEVEL + (idx))
+#define TW_LIST_IMMEDIATE (TW_NEAR + TW_LEVELS * TW_LEVEL)
+#define TW_NLIST (TW_LIST_IMMEDIATE + 1)
+#define TW_LIST_FREE 0xffff
+
+// keep the top level slot of a far timer distinct from the current one
+#define TW_MAX_DELAY ((((uint64_t)TW_LEVEL - 1) << (TW_NEAR_BITS + (TW_LEVELS - 1) * TW_LEVEL_BITS)) - 1)
+
+#define TW_GEN_MASK 0xfffff
+#define TW_HANDLE(gen, idx) (((uint64_t)(gen) << 32) | (idx))
+#define TW_MIN_NODES 1024
+
+typedef struct {
+    uint32_t next;     // 0 is nil, node 0 is never used
+    uint32_t prev;
+    uint32_t gen;
+    uint16_t list;
+    uint64_t expire;
+} tw_node_t;
+
+struct timewheel_s {
+    uint64_t time;                  // current tick
+    uint32_t count;
+    uint32_t heads[TW_NLIST];
+    uint32_t tails[TW_NLIST];
+    uint64_t near_bits[TW_NEAR / 64];
+    tw_node_t *nodes;
+    uint32_t nnode;
+    uint32_t free_head;
+};
+
+static inline void
+near_mark(timewheel_t *w, uint32_t slot) {
+    w->near_bits[slot >> 6] |= (uint64_t)1 << (slot & 63);
+}
+
+static inline void
+near_clear(timewheel_t *w, uint32_t slot) {
+    w->near_bits[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+}
+
+static void
+list_append(timewheel_t *w, uint32_t list, uint32_t idx) {
+    tw_node_t *node = &w->nodes[idx];
+    node->list = list;
+    node->next = 0;
+    node->prev = w->tails[list];
+    if (node->prev)
+        w->nodes[node->prev].next = idx;
+    else
+        w->heads[list] = idx;
+    w->tails[list] = idx;
+    if (list < TW_NEAR)
+        near_mark(w, list);
+}
+
+static void
+list_remove(timewheel_t *w, uint32_t idx) {
+    tw_node_t *node = &w->nodes[idx];
+    uint32_t list = node->list;
+    if (node->prev)
+        w->nodes[node->prev].next = node->next;
+    else
+        w->heads[list] = node->next;
+    if (node->next)
+        w->nodes[node->next].prev = node->prev;
+    else
+        w->tails[list] = node->prev;
+    if (list < TW_NEAR && w->heads[list] == 0)
+        near_clear(w, list);
+}
+
+static void
+add_node(timewheel_t *w, uint32_t idx) {
+    uint64_t expire = w->nodes[idx].expire;
+    uint64_t cur = w->time;
+    if ((expire | TW_NEAR_MASK) == (cur | TW_NEAR_MASK)) {
+        list_append(w, expire & TW_NEAR_MASK, idx);
+        return;
+    }
+    uint64_t mask = (uint64_t)TW_NEAR << TW_LEVEL_BITS;
+    int i;
+    for (i = 0; i < TW_LEVELS - 1; i++) {
+        if ((expire | (mask - 1)) == (cur | (mask - 1)))
+            break;
+        mask <<= TW_LEVEL_BITS;
+    }
+    uint32_t slot = (expire >> (TW_NEAR_BITS + i * TW_LEVEL_BITS)) & TW_LEVEL_MASK;
+    list_append(w, TW_LIST_LEVEL(i, slot), idx);
+}
+
+static void
+move_list(timewheel_t *w, int level, int slot) {
+    uint32_t list = TW_LIST_LEVEL(level, slot);
+    uint32_t idx = w->heads[list];
+    w->heads[list] = w->tails[list] = 0;
+    while (idx) {
+        uint32_t next = w->nodes[idx].next;
+        add_node(w, idx);
+        idx = next;
+    }
+}
+
+static void
+shift(timewheel_t *w) {
+    uint64_t ct = ++w->time;
+    uint64_t mask = TW_NEAR;
+    uint64_t t = ct >> TW_NEAR_BITS;
+    int i = 0;
+    while ((ct & (mask - 1)) == 0) {
+        int idx = t & TW_LEVEL_MASK;
+        if (idx != 0 || i == TW_LEVELS - 1) {
+            move_list(w, i, idx);
+            break;
+        }
+        mask <<= TW_LEVEL_BITS;
+        t >>= TW_LEVEL_BITS;
+        ++i;
+    }
+}
+
+static void
+free_node(timewheel_t *w, uint32_t idx) {
+    tw_node_t *node = &w->nodes[idx];
+    node->list = TW_LIST_FREE;
+    node->gen = (node->gen + 1) & TW_GEN_MASK;
+    node->next = w->free_head;
+    w->free_head = idx;
+    w->count--;
+}
+
+static int
+dispatch_list(timewheel_t *w, uint32_t list, tw_expire_cb cb, void *ud) {
+    int n = 0;
+    uint32_t idx;
+    while ((idx = w->heads[list]) != 0) {
+        uint64_t handle = TW_HANDLE(w->nodes[idx].gen, idx);
+        list_remove(w, idx);
+        free_node(w, idx);
+        cb(ud, handle);
+        n++;
+    }
+    return n;
+}
+
+static int
+grow_nodes(timewheel_t *w) {
+    uint32_t n = w->nnode ? w->nnode * 2 : TW_MIN_NODES;
+    tw_node_t *nodes = realloc(w->nodes, n * sizeof(tw_node_t));
+    if (nodes == NULL)
+        return -1;
+    memset(nodes + w->nnode, 0, (n - w->nnode) * sizeof(tw_node_t));
+    // node 0 stays reserved as nil
+    uint32_t first = w->nnode ? w->nnode : 1;
+    for (uint32_t i = n - 1; i >= first; i--) {
+        nodes[i].list = TW_LIST_FREE;
+        nodes[i].next = w->free_head;
+        w->free_head = i;
+    }
+    w->nodes = nodes;
+    w->nnode = n;
+    return 0;
+}
+
+timewheel_t *
+tw_create(uint64_t now) {
+    timewheel_t *w = calloc(1, sizeof(timewheel_t));
+    if (w == NULL)
+        return NULL;
+    w->time = now;
+    if (grow_nodes(w) < 0) {
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void
+tw_free(timewheel_t *w) {
+    free(w->nodes);
+    free(w);
+}
+
+uint64_t
+tw_add(timewheel_t *w, int64_t delay) {
+    if (w->free_head == 0 && grow_nodes(w) < 0)
+        return 0;
+    uint32_t idx = w->free_head;
+    tw_node_t *node = &w->nodes[idx];
+    w->free_head = node->next;
+    w->count++;
+    if (delay <= 0) {
+        // due right away, reported by the next tw_expire
+        node->expire = w->time;
+        list_append(w, TW_LIST_IMMEDIATE, idx);
+    } else {
+        if ((uint64_t)delay > TW_MAX_DELAY)
+            delay = TW_MAX_DELAY;
+        node->expire = w->time + delay;
+        add_node(w, idx);
+    }
+    return TW_HANDLE(node->gen, idx);
+}
+
+int
+tw_cancel(timewheel_t *w, uint64_t handle) {
+    uint32_t idx = (uint32_t)handle;
+    uint32_t gen = (uint32_t)(handle >> 32);
+    if (idx == 0 || idx >= w->nnode)
+        return 0;
+    tw_node_t *node = &w->nodes[idx];
+    if (node->list == TW_LIST_FREE || node->gen != gen)
+        return 0;
+    list_remove(w, idx);
+    free_node(w, idx);
+    return 1;
+}
+
+int
+tw_expire(timewheel_t *w, uint64_t now, tw_expire_cb cb, void *ud) {
+    int n = dispatch_list(w, TW_LIST_IMMEDIATE, cb, ud);
+    while (w->time < now) {
+        shift(w);
+        n += dispatch_list(w, w->time & TW_NEAR_MASK, cb, ud);
+    }
+    return n;
+}
+
+int64_t
+tw_next(timewheel_t *w) {
+    if (w->count == 0)
+        return -1;
+    if (w->heads[TW_LIST_IMMEDIATE])
+        return 0;
+    // first occupied near slot after the current tick, within this near round
+    uint32_t cur = w->time & TW_NEAR_MASK;
+    for (uint32_t slot = cur + 1; slot < TW_NEAR; ) {
+        uint64_t bits = w->near_bits[slot >> 6] >> (slot & 63);
+        if (bits)
+            return slot + __builtin_ctzll(bits) - cur;
+        slot = (slot | 63) + 1;
+    }
+    // nothing near, wake up at the next cascade
+    return TW_NEAR - cur;
+}
+
+uint32_t
+tw_count(timewheel_t *w) {
+    return w->count;
+}
@@ -0,0 +1,33 @@
+#ifndef timewheel_h
+#define timewheel_h
+#include <stdint.h>
+
+// Hierarchical timing wheel: 256 near slots plus 4 levels of 64 slots.
+// Timers are addressed by integer handles, add and cancel are O(1).
+typedef struct timewheel_s timewheel_t;
+
+// Called for every expired timer handle during tw_expire
+typedef void (*tw_expire_cb)(void *ud, uint64_t handle);
+
+// Creates a wheel whose current tick is `now`
+timewheel_t *tw_create(uint64_t now);
+
+// Frees the wheel and all pending timers
+void tw_free(timewheel_t *w);
+
+// Adds a timer expiring `delay` ticks after the current tick, returns its handle (0 on failure)
+uint64_t tw_add(timewheel_t *w, int64_t delay);
+
+// Cancels a pending timer, returns 1 if it was pending
+int tw_cancel(timewheel_t *w, uint64_t handle);
+
+// Advances the wheel to tick `now`, reporting every expired timer in expiry order
+int tw_expire(timewheel_t *w, uint64_t now, tw_expire_cb cb, void *ud);
+
+// Ticks until the next timer may expire, -1 if no timer is pending
+int64_t tw_next(timewheel_t *w);
+
+// Number of pending timers
+uint32_t tw_count(timewheel_t *w);
+
+#endif
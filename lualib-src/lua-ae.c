@@ -1,6 +1,10 @@
+#include <errno.h>
+#include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include "ae.h"
+#include "lua-stats.h"
+#include "systime.h"
 
 static int 
 lcreate(lua_State *L) {
@@ -38,6 +42,17 @@ ladd_write(lua_State *L) {
     return 1;
 }
 
+static int
+ladd_read_et(lua_State *L) {
+    int aefd = luaL_checkinteger(L, 1);
+    int fd = luaL_checkinteger(L, 2);
+    int ret = ae_add_read_et(aefd, fd);
+    if (ret == -1)
+        return luaL_error(L, "add event error");
+    lua_pushinteger(L, ret);
+    return 1;
+}
+
 static int
 lenable(lua_State *L) {
     int aefd = luaL_checkinteger(L, 1);
@@ -94,13 +109,17 @@ lpoll(lua_State *L) {
     int timeout = luaL_checkinteger(L, 2);
     int nfired = luaL_checkinteger(L, 3);
     event_t e[nfired];
+    loop_stats_t *st = loop_stats(L);
+    uint64_t begin = loop_stats_poll_begin(st);
     int n = ae_poll(aefd, e, nfired, timeout);
+    loop_stats_poll_end(st, begin, n);
     lua_getfield(L, LUA_REGISTRYINDEX, "gamenet.update_time");
     lua_pushvalue(L, 4);
     lua_call(L, 0, 0);
     lua_getfield(L, LUA_REGISTRYINDEX, "gamenet.ev_handler");
     for(int i = 0; i < n; i++)
     {
+        loop_stats_mark(st, e[i].fd);
         lua_pushvalue(L, 5);
         lua_pushinteger(L, e[i].fd);
         lua_pushboolean(L, e[i].read);
@@ -113,7 +132,115 @@ lpoll(lua_State *L) {
         lua_pushvalue(L, 4);
         lua_call(L, 0, 0);
     }
-    return 0;
+    loop_stats_mark(st, -1);
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+// polls in a row under a quarter full before the fired array is halved
+#define MAXEVENT_IDLE_POLLS 32
+
+// double the fired array when a poll fills it, so an accept storm drains in
+// fewer polls, and halve it back after a run of mostly empty polls
+static void
+adapt_maxevents(loop_stats_t *st, int n, int limit) {
+    if (n >= st->maxevents) {
+        st->idle_polls = 0;
+        if (st->maxevents < limit) {
+            st->maxevents = st->maxevents * 2 < limit ? st->maxevents * 2 : limit;
+            st->maxevents_grow++;
+        }
+    } else if (n < st->maxevents / 4 && st->maxevents > AE_MAXEVENT) {
+        if (++st->idle_polls >= MAXEVENT_IDLE_POLLS) {
+            st->idle_polls = 0;
+            st->maxevents /= 2;
+            st->maxevents_shrink++;
+        }
+    } else {
+        st->idle_polls = 0;
+    }
+}
+
+// busy poll with timeout 0 for up to spin_us before blocking, trades cpu for
+// the scheduler wakeup latency. timeout is shortened by the time spun,
+// only polls that fired count as hits and a poll error ends the spin
+static int
+spin_poll(loop_stats_t *st, int aefd, event_t *e, int nfired, int timeout,
+    int spin_us, uint64_t begin) {
+    uint64_t now;
+    do {
+        int n = ae_poll(aefd, e, nfired, 0);
+        if (n > 0) {
+            st->spin_hits++;
+            return n;
+        }
+        if (n < 0 && errno != EINTR)
+            return n;
+        now = systime_mono_us();
+    } while (now - begin < (uint64_t)spin_us);
+    st->spin_misses++;
+    if (timeout > 0) {
+        int spent = (now - begin) / 1000;
+        timeout = timeout > spent ? timeout - spent : 0;
+    }
+    return ae_poll(aefd, e, nfired, timeout);
+}
+
+// fill a reused table with (fd, mask) pairs, the caller dispatches them in
+// one lua loop instead of one lua_call per fired event.
+// maxevent is the upper bound, the size used adapts between AE_MAXEVENT and it.
+// returns the number of events or nil, err if the poll failed
+static int
+lpoll_batch(lua_State *L) {
+    int aefd = luaL_checkinteger(L, 1);
+    int timeout = luaL_checkinteger(L, 2);
+    int limit = luaL_optinteger(L, 3, AE_MAXEVENT);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    int spin_us = luaL_optinteger(L, 5, 0);
+    if (limit < AE_MAXEVENT)
+        limit = AE_MAXEVENT;
+    else if (limit > AE_MAXEVENT_LIMIT)
+        limit = AE_MAXEVENT_LIMIT;
+    loop_stats_t *st = loop_stats(L);
+    if (st->maxevents > limit)
+        st->maxevents = limit;
+    int nfired = st->maxevents;
+    event_t e[nfired];
+    uint64_t begin = loop_stats_poll_begin(st);
+    int n;
+    if (spin_us > 0 && timeout != 0)
+        n = spin_poll(st, aefd, e, nfired, timeout, spin_us, begin);
+    else
+        n = ae_poll(aefd, e, nfired, timeout);
+    int err = errno;
+    loop_stats_poll_end(st, begin, n);
+    if (n < 0) {
+        // a signal only cut the wait short
+        if (err != EINTR) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(err));
+            return 2;
+        }
+        n = 0;
+    }
+    adapt_maxevents(st, n, limit);
+    for (int i = 0; i < n; i++) {
+        int mask = (e[i].read ? AE_READABLE : 0) | (e[i].write ? AE_WRITABLE : 0) |
+            (e[i].error ? AE_ERR : 0);
+        lua_pushinteger(L, e[i].fd);
+        lua_rawseti(L, 4, 2*i + 1);
+        lua_pushinteger(L, mask);
+        lua_rawseti(L, 4, 2*i + 2);
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+static int
+lerror(lua_State *L) {
+    int fd = luaL_checkinteger(L, 1);
+    lua_pushstring(L, socket_error(fd));
+    return 1;
 }
 
 static const struct luaL_Reg lib[] =
@@ -123,11 +250,14 @@ static const struct luaL_Reg lib[] =
     
     {"add_read", ladd_read},
     {"add_write", ladd_write},
+    {"add_read_et", ladd_read_et},
     {"enable", lenable},
     {"del", ldel},
     {"wait", lwait},
     
     {"poll", lpoll},
+    {"poll_batch", lpoll_batch},
+    {"error", lerror},
     {"register", lregister},
 
     {NULL,NULL}
@@ -1,16 +1,140 @@
 
 #include "anet.h"
+#include "admit.h"
+#include "systime.h"
+#include "lua-stats.h"
 #include <lua.h>
 #include <lauxlib.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
 
+#define ACCEPT_BATCH_MAX 1024
+#define PROFILE_META "gamenet.anet_profile"
+#define ADMISSION_META "gamenet.admission"
+#define ADMISSION_SLOTS 4096
+#define PUMP_META "gamenet.anet_pump"
+
+typedef struct {
+    admit_t *a;
+} ladmission_t;
+
+typedef struct {
+    admit_t *a;
+    loop_stats_t *st;
+    uint64_t now;
+} admit_ctx_t;
+
+static const anet_profile_t *
+opt_profile(lua_State *L, int idx) {
+    if (lua_isnoneornil(L, idx))
+        return NULL;
+    return (const anet_profile_t *)luaL_checkudata(L, idx, PROFILE_META);
+}
+
+// anet.profile({[option] = value, ...}), options as in setoption
+static int
+lprofile(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    anet_profile_t *p = (anet_profile_t *)lua_newuserdata(L, sizeof(anet_profile_t));
+    anet_profile_init(p);
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        int option = lua_tointeger(L, -2);
+        if (option <= 0 || option >= SOCK_OPT_MAX)
+            return luaL_error(L, "unsupported option %d", option);
+        p->val[option] = luaL_checkinteger(L, -1);
+        lua_pop(L, 1);
+    }
+    luaL_getmetatable(L, PROFILE_META);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static double
+opt_number(lua_State *L, int idx, const char *name, double def) {
+    lua_getfield(L, idx, name);
+    double v = luaL_optnumber(L, -1, def);
+    lua_pop(L, 1);
+    return v;
+}
+
+// anet.admission({rate, burst, ip_rate, ip_burst, slots}), rates per second,
+// a missing rate disables that bucket, bursts default to one second of rate
+static int
+ladmission(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    double rate = opt_number(L, 1, "rate", 0);
+    double burst = opt_number(L, 1, "burst", rate);
+    double ip_rate = opt_number(L, 1, "ip_rate", 0);
+    double ip_burst = opt_number(L, 1, "ip_burst", ip_rate);
+    int slots = opt_number(L, 1, "slots", ADMISSION_SLOTS);
+    luaL_argcheck(L, slots > 0 && slots <= (1 << 24), 1, "slots out of range");
+    ladmission_t *la = (ladmission_t *)lua_newuserdata(L, sizeof(ladmission_t));
+    la->a = NULL;
+    luaL_getmetatable(L, ADMISSION_META);
+    lua_setmetatable(L, -2);
+    la->a = admit_create(rate, burst, ip_rate, ip_burst, slots);
+    if (la->a == NULL)
+        return luaL_error(L, "admission out of memory");
+    return 1;
+}
+
+static int
+ladmission_gc(lua_State *L) {
+    ladmission_t *la = (ladmission_t *)luaL_checkudata(L, 1, ADMISSION_META);
+    if (la->a) {
+        admit_free(la->a);
+        la->a = NULL;
+    }
+    return 0;
+}
+
+static int
+admit_filter(const struct sockaddr_storage *sa, void *ud) {
+    admit_ctx_t *ctx = (admit_ctx_t *)ud;
+    switch (admit_check(ctx->a, sa, ctx->now)) {
+    case ADMIT_REJECT_RATE:
+        ctx->st->rejected_rate++;
+        return 0;
+    case ADMIT_REJECT_IP:
+        ctx->st->rejected_ip++;
+        return 0;
+    }
+    return 1;
+}
+
+// anet.apply_profile(fd, profile) -> true or false, err of the last failure
+static int
+lapply_profile(lua_State *L) {
+    int fd = luaL_checkinteger(L, 1);
+    const anet_profile_t *p = (const anet_profile_t *)luaL_checkudata(L, 2, PROFILE_META);
+    if (anet_profile_apply(fd, p) < 0) {
+        lua_pushboolean(L, false);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
 static int
 llisten(lua_State *L) {
     const char * host = luaL_checkstring(L, 1);
     int port = luaL_checkinteger(L, 2);
     int backlog = luaL_optinteger(L, 3, 32);
-    int fd = anet_tcp_listen(host, port, backlog);
+    int reuseport = lua_toboolean(L, 4);
+    int fd = anet_tcp_listen(host, port, backlog, reuseport);
+    if (fd < 0)
+        return luaL_error(L, strerror(errno));
+    lua_pushinteger(L, fd);
+    return 1;
+}
+
+static int
+lunix_listen(lua_State *L) {
+    const char * path = luaL_checkstring(L, 1);
+    int backlog = luaL_optinteger(L, 2, 32);
+    int fd = anet_unix_listen(path, backlog);
     if (fd < 0)
         return luaL_error(L, strerror(errno));
     lua_pushinteger(L, fd);
@@ -20,7 +144,7 @@ llisten(lua_State *L) {
 static int
 ltcp_accept(lua_State *L) {
     int fd = luaL_checkinteger(L, 1);
-    char ip[INET_ADDRSTRLEN] = {0};
+    char ip[INET6_ADDRSTRLEN] = {0};
     int port = -1;
     int clientfd = anet_tcp_accept(fd, ip, &port);
     if (clientfd < 0)
@@ -31,12 +155,68 @@ ltcp_accept(lua_State *L) {
     return 3;
 }
 
+// accept up to max pending connections in one call,
+// out = {fd1, ip1, port1, fd2, ip2, port2, ...}, returns n or nil, err.
+// the optional profile is applied to every accepted socket here in c, the
+// optional admission closes connections over its rates before lua sees them
+static int
+ltcp_accept_batch(lua_State *L) {
+    int fd = luaL_checkinteger(L, 1);
+    int max = luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    const anet_profile_t *profile = opt_profile(L, 4);
+    admit_ctx_t ctx;
+    if (!lua_isnoneornil(L, 5)) {
+        ctx.a = ((ladmission_t *)luaL_checkudata(L, 5, ADMISSION_META))->a;
+        ctx.st = loop_stats(L);
+        ctx.now = systime_mono_us();
+    }
+    if (max <= 0)
+        return luaL_argerror(L, 2, "must be positive");
+    if (max > ACCEPT_BATCH_MAX)
+        max = ACCEPT_BATCH_MAX;
+    anet_conn_t conns[max];
+    int n = anet_tcp_accept_batch(fd, conns, max, profile,
+        lua_isnoneornil(L, 5) ? NULL : admit_filter, &ctx);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    for (int i = 0; i < n; i++) {
+        lua_pushinteger(L, conns[i].fd);
+        lua_rawseti(L, 3, 3*i + 1);
+        lua_pushstring(L, conns[i].ip);
+        lua_rawseti(L, 3, 3*i + 2);
+        lua_pushinteger(L, conns[i].port);
+        lua_rawseti(L, 3, 3*i + 3);
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
 static int
 ltcp_connect(lua_State* L) {
     const char * addr = luaL_checkstring(L, 1);
     int port = luaL_checkinteger(L, 2);
-    int fd = anet_tcp_connect(addr, port);
+    int fd = anet_tcp_connect(addr, port, opt_profile(L, 3));
     lua_pushinteger(L, fd);
+    if (fd < 0) {
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    return 1;
+}
+
+static int
+lunix_connect(lua_State* L) {
+    const char * path = luaL_checkstring(L, 1);
+    int fd = anet_unix_connect(path);
+    lua_pushinteger(L, fd);
+    if (fd < 0) {
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
     return 1;
 }
 
@@ -92,19 +272,107 @@ ltcp_setopt(lua_State *L) {
     return 2;
 }
 
+static anet_pump_t *
+check_pump(lua_State *L) {
+    anet_pump_t *p = (anet_pump_t *)luaL_checkudata(L, 1, PUMP_META);
+    if (p->pipe[0] < 0)
+        luaL_error(L, "pump already closed");
+    return p;
+}
+
+// anet.pump() -> a pipe to forward bytes between sockets, or nil, err
+static int
+lpump(lua_State *L) {
+    anet_pump_t *p = (anet_pump_t *)lua_newuserdata(L, sizeof(anet_pump_t));
+    p->pipe[0] = p->pipe[1] = -1;
+    luaL_getmetatable(L, PUMP_META);
+    lua_setmetatable(L, -2);
+    if (anet_pump_open(p) < 0) {
+        p->pipe[0] = p->pipe[1] = -1;
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    return 1;
+}
+
+// p:run(src, dst) -> "read"|"write"|"eof", bytes or nil, err, bytes.
+// "read" waits for src readable, "write" for dst writable
+static int
+lpump_run(lua_State *L) {
+    static const char *states[] = {"read", "write", "eof"};
+    anet_pump_t *p = check_pump(L);
+    int src = luaL_checkinteger(L, 2);
+    int dst = luaL_checkinteger(L, 3);
+    uint64_t moved;
+    int ret = anet_pump(p, src, dst, &moved);
+    if (ret < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        lua_pushnumber(L, moved);
+        return 3;
+    }
+    lua_pushstring(L, states[ret]);
+    lua_pushnumber(L, moved);
+    return 2;
+}
+
+static int
+lpump_pending(lua_State *L) {
+    lua_pushinteger(L, check_pump(L)->pending);
+    return 1;
+}
+
+static int
+lpump_close(lua_State *L) {
+    anet_pump_t *p = (anet_pump_t *)luaL_checkudata(L, 1, PUMP_META);
+    if (p->pipe[0] >= 0) {
+        anet_pump_close(p);
+        p->pipe[0] = p->pipe[1] = -1;
+    }
+    return 0;
+}
+
 static const struct luaL_Reg lib[] = {
     {"listen", llisten},
+    {"unix_listen", lunix_listen},
 
     {"accept", ltcp_accept},
+    {"accept_batch", ltcp_accept_batch},
     {"connect", ltcp_connect},
+    {"unix_connect", lunix_connect},
     {"close", ltcp_close},
 
     {"getoption", ltcp_getopt},
     {"setoption", ltcp_setopt},
+    {"profile", lprofile},
+    {"apply_profile", lapply_profile},
+    {"admission", ladmission},
+    {"pump", lpump},
     {NULL, NULL}
 };
 
 int luaopen_gamenet_anet(lua_State *L) {
+    luaL_newmetatable(L, PROFILE_META);
+    lua_pop(L, 1);
+    if (luaL_newmetatable(L, ADMISSION_META)) {
+        lua_pushcfunction(L, ladmission_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+    if (luaL_newmetatable(L, PUMP_META)) {
+        luaL_Reg m[] = {
+            {"run", lpump_run},
+            {"pending", lpump_pending},
+            {"close", lpump_close},
+            {NULL, NULL},
+        };
+        luaL_newlib(L, m);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lpump_close);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
     luaL_newlib(L, lib);
     return 1;
 }
@@ -1,23 +1,96 @@
-
+#include <string.h>
 #include <stdbool.h>
 #include <arpa/inet.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include "buffer.h"
 #include "anet.h"
+#include "ae.h"
+
+#define READ_DRAIN_MAX 4096
+#define FLUSH_IOV_MAX 64     // chains per writev
+#define FRAME_META "gamenet.framespec"
+#define FRAME_MAX_DEFAULT (1024 * 1024)
+#define FRAME_VARINT_MAX 5   // a 32 bit length
+#define FRAME_HEADER_MAX (FRAME_VARINT_MAX + 4)
+
+// a length-prefixed frame: [length][extra] body
+typedef struct {
+    int len;            // bytes of the length field: 2, 3, 4, or 0 for a varint
+    bool big;           // big-endian length and extra
+    int extra;          // header bytes after the length (0-4), returned as an integer
+    bool include;       // the length counts the header too
+    uint32_t max;       // largest body accepted
+} framespec_t;
+
+// reads straight into the tail of the buffer, when the tail chain is short
+// readv spills the rest into a fresh chain. returns like anet_tcp_readv,
+// -3 if no space could be reserved, -4 on overflow
+static int
+read_into(buffer_t *p, int fd, int sz) {
+    struct iovec iov[2];
+    int cnt = buffer_reserve_iov(p, sz, iov);
+    if (cnt == 0)
+        return -3;
+    if (iov[0].iov_len >= sz) {
+        iov[0].iov_len = sz;
+        cnt = 1;
+    } else if (cnt == 2 && iov[0].iov_len + iov[1].iov_len > sz) {
+        iov[1].iov_len = sz - iov[0].iov_len;
+    }
+    int n = ae_readv(fd, iov, cnt);
+    if (n > 0 && buffer_commit_iov(p, iov, cnt, n) < 0)
+        return -4;
+    return n;
+}
+
+// edge-triggered read: keep reading until EAGAIN so that no readiness is lost.
+// returns the drained byte count, plus an error message if the peer closed or
+// failed after (or before) the last chunk.
+static int
+read_until_eagain(lua_State *L, buffer_t *p, int fd, int sz) {
+    uint32_t total = 0;
+    const char *err = NULL;
+    if (sz > READ_DRAIN_MAX)
+        sz = READ_DRAIN_MAX;
+    for (;;) {
+        int n = read_into(p, fd, sz);
+        if (n == -2) {
+            lua_pushinteger(L, total);
+            return 1;
+        } else if (n == 0) {
+            err = "closed (read return zero)";
+            break;
+        } else if (n == -1) {
+            err = strerror(errno);
+            break;
+        } else if (n == -3) {
+            err = "cant find continuous space for read";
+            break;
+        } else if (n == -4) {
+            err = "buffer overflow";
+            break;
+        }
+        total += n;
+        if (n == sz && sz < READ_DRAIN_MAX)
+            sz <<= 1;
+    }
+    if (total > 0)
+        lua_pushinteger(L, total);
+    else
+        lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+}
 
 static int
 lread(lua_State *L) {
     buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
     int fd = luaL_checkinteger(L, 2);
     int sz = luaL_checkinteger(L, 3);
-    uint8_t * buf = buffer_available_chunk(p, sz);
-    if (buf == NULL) {
-        lua_pushnil(L);
-        lua_pushliteral(L, "cant find continuous space for read");
-        return 2;
-    }
-    int n = anet_tcp_read(fd, buf, sz);
+    if (lua_toboolean(L, 4))
+        return read_until_eagain(L, p, fd, sz);
+    int n = read_into(p, fd, sz);
     switch (n) {
     case 0:
         lua_pushnil(L);
@@ -30,69 +103,134 @@ lread(lua_State *L) {
     case -2:
         lua_pushinteger(L, 0);
         return 1;
+    case -3:
+        lua_pushnil(L);
+        lua_pushliteral(L, "cant find continuous space for read");
+        break;
+    case -4:
+        lua_pushnil(L);
+        lua_pushliteral(L, "buffer overflow");
+        break;
     default:
         lua_pushinteger(L, n);
-        buffer_add(p, buf, n);
         return 1;
     }
     return 2;
 }
 
+// the high watermark is reported once when crossed, the low one once the
+// backlog drains back down to it
+static int
+push_watermark(lua_State *L, buffer_t *p) {
+    if (p->high_wm == 0)
+        return 0;
+    if (!p->over_wm && p->total_len >= p->high_wm) {
+        p->over_wm = 1;
+        lua_pushliteral(L, "high");
+        return 1;
+    }
+    if (p->over_wm && p->total_len <= p->low_wm) {
+        p->over_wm = 0;
+        lua_pushliteral(L, "low");
+        return 1;
+    }
+    return 0;
+}
+
+// b:write(fd, data, defer) -> sent (nothing left queued), "high" | nil
+// false, "overflow" if the backlog can't take data (BUFFER_CHAIN_MAX)
 static int
 lwrite(lua_State *L) {
     buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
-    // printf("lwrite:%p\n", p);
     int fd = luaL_checkinteger(L, 2);
     size_t len = 0;
     const char *buf = luaL_checklstring(L, 3, &len);
-    if (p->total_len > 0) {
-        buffer_add(p, buf, len);
-        lua_pushboolean(L, true);
+    int ret = 0;
+    bool sent = true;
+    // defer: only queue it, the loop flushes at the end of the iteration
+    if (p->total_len > 0 || lua_toboolean(L, 4)) {
+        ret = buffer_add(p, buf, len);
     } else {
-        int n = anet_tcp_write(fd, buf, len);
+        struct iovec iov = { (void *)buf, len };
+        int n = ae_writev(fd, &iov, 1);
         switch (n)
         {
         case -1:
-            lua_pushboolean(L, true);
             break;
         case -2:
-            buffer_add(p, buf, len);
-            lua_pushboolean(L, false);
+            ret = buffer_add(p, buf, len);
+            sent = false;
             break;
         default:
             if (n < len) {
-                buffer_add(p, buf+n, len-n);
-                lua_pushboolean(L, false);
-            } else {
-                lua_pushboolean(L, true);
+                ret = buffer_add(p, buf+n, len-n);
+                sent = false;
             }
             break;
         }
     }
+    if (ret < 0) {
+        lua_pushboolean(L, false);
+        lua_pushliteral(L, "overflow");
+        return 2;
+    }
+    lua_pushboolean(L, sent);
+    return 1 + push_watermark(L, p);
+}
+
+// b:watermark(high, low), high 0 turns backpressure off
+static int
+lwatermark(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    uint32_t high = luaL_checkinteger(L, 2);
+    uint32_t low = luaL_optinteger(L, 3, high / 2);
+    luaL_argcheck(L, high == 0 || low < high, 3, "low watermark must be below the high one");
+    p->high_wm = high;
+    p->low_wm = low;
+    p->over_wm = high > 0 && p->total_len >= high;
+    return 0;
+}
+
+static int
+lsize(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    lua_pushinteger(L, p->total_len);
     return 1;
 }
 
+// scatter/gather straight from the chains, the backlog is never linearized.
+// drain: keep writing until the socket is full or the buffer is empty
+// cork: hold back partial segments with TCP_CORK when one writev isn't enough
+// returns whether the buffer is empty, the writev calls made, and "low" once
+// a backlog over the high watermark drained down to the low one
 static int
 lflush(lua_State *L) {
     buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
     int fd = luaL_checkinteger(L, 2);
-    if (p->total_len <= 0) {
-        lua_pushboolean(L, true);
-        return 1;
-    }
-    uint8_t * buf = buffer_write_atmost(p);
-    if (buf == NULL) {
-        lua_pushboolean(L, false);
-        return 1;
-    }
-    int n = anet_tcp_write(fd, buf, p->total_len);
-    if (n <= 0) {
-        lua_pushboolean(L, false);
-        return 1;
+    bool drain = lua_toboolean(L, 3);
+    bool cork = lua_toboolean(L, 4);
+    bool corked = false;
+    int calls = 0;
+    struct iovec iov[FLUSH_IOV_MAX];
+    while (p->total_len > 0) {
+        uint32_t bytes;
+        int cnt = buffer_peek_iov(p, iov, FLUSH_IOV_MAX, &bytes);
+        if (cork && calls == 1 && !corked)
+            corked = anet_tcp_setoption(fd, SOCK_OPT_CORK, 1) == 0;
+        int n = ae_writev(fd, iov, cnt);
+        calls++;
+        if (n <= 0)
+            break;
+        buffer_drain(p, n);
+        // a short write means the socket buffer is full
+        if ((uint32_t)n < bytes || !drain)
+            break;
     }
-    buffer_drain(p, n);
+    if (corked)
+        anet_tcp_setoption(fd, SOCK_OPT_CORK, 0);
     lua_pushboolean(L, p->total_len <= 0);
-    return 1;
+    lua_pushinteger(L, calls);
+    return 2 + push_watermark(L, p);
 }
 
 static int
@@ -147,11 +285,177 @@ lreadline(lua_State *L) {
     return 1;
 }
 
+static uint32_t
+frame_uint(const uint8_t *p, int n, bool big) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++)
+        v |= (uint32_t)p[i] << (8 * (big ? n - 1 - i : i));
+    return v;
+}
+
+// 1 with the header and body sizes once they are known, 0 if more bytes are
+// needed, -1 with an error message for a malformed or oversized frame
+static int
+frame_parse(buffer_t *p, const framespec_t *spec, uint32_t *hdr, uint32_t *body,
+    uint32_t *extra, const char **err) {
+    uint8_t h[FRAME_HEADER_MAX];
+    uint32_t n = buffer_copyout(p, h, FRAME_HEADER_MAX);
+    uint32_t len = 0, lenbytes = spec->len;
+    if (spec->len == 0) {
+        for (lenbytes = 0; ; lenbytes++) {
+            if (lenbytes == FRAME_VARINT_MAX) {
+                *err = "bad varint frame length";
+                return -1;
+            }
+            if (lenbytes == n)
+                return 0;
+            // the fifth byte only has room for the top 4 bits of 32
+            if (lenbytes == FRAME_VARINT_MAX - 1 && (h[lenbytes] & 0xf0)) {
+                *err = "bad varint frame length";
+                return -1;
+            }
+            len |= (uint32_t)(h[lenbytes] & 0x7f) << (7 * lenbytes);
+            if ((h[lenbytes] & 0x80) == 0)
+                break;
+        }
+        lenbytes++;
+    } else {
+        if (n < lenbytes)
+            return 0;
+        len = frame_uint(h, lenbytes, spec->big);
+    }
+    if (n < lenbytes + spec->extra)
+        return 0;
+    *extra = frame_uint(h + lenbytes, spec->extra, spec->big);
+    *hdr = lenbytes + spec->extra;
+    if (spec->include) {
+        if (len < *hdr) {
+            *err = "frame length shorter than its header";
+            return -1;
+        }
+        len -= *hdr;
+    }
+    if (len > spec->max) {
+        *err = "frame too big";
+        return -1;
+    }
+    *body = len;
+    return p->total_len - *hdr >= len;
+}
+
+// b:readframe(spec) -> body, extra once a whole frame is buffered,
+// nil if it isn't yet, false, err if the frame is malformed or too big
+static int
+lreadframe(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    const framespec_t *spec = (const framespec_t *)luaL_checkudata(L, 2, FRAME_META);
+    uint32_t hdr, body, extra;
+    const char *err;
+    int ret = frame_parse(p, spec, &hdr, &body, &extra, &err);
+    if (ret <= 0) {
+        if (ret == 0) {
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_pushboolean(L, false);
+        lua_pushstring(L, err);
+        return 2;
+    }
+    buffer_drain(p, hdr);
+    if (body > 0)
+        lua_buffer_read(L, p, body, 0);
+    else
+        lua_pushliteral(L, "");
+    p->last_read_pos = 0;
+    lua_pushinteger(L, extra);
+    return 2;
+}
+
+// buffer.framespec{len = 2|3|4|"varint", endian = "be"|"le", extra = 0, include = false, max = 1M}
+static int
+lframespec(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    framespec_t *spec = (framespec_t *)lua_newuserdata(L, sizeof(framespec_t));
+    lua_getfield(L, 1, "len");
+    if (lua_type(L, -1) == LUA_TSTRING && strcmp(lua_tostring(L, -1), "varint") == 0)
+        spec->len = 0;
+    else
+        spec->len = luaL_checkinteger(L, -1);
+    lua_getfield(L, 1, "endian");
+    const char *endian = luaL_optstring(L, -1, "be");
+    spec->big = strcmp(endian, "be") == 0;
+    luaL_argcheck(L, spec->big || strcmp(endian, "le") == 0, 1, "endian must be be or le");
+    lua_getfield(L, 1, "extra");
+    spec->extra = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "include");
+    spec->include = lua_toboolean(L, -1);
+    lua_getfield(L, 1, "max");
+    spec->max = luaL_optnumber(L, -1, FRAME_MAX_DEFAULT);
+    lua_pop(L, 5);
+    luaL_argcheck(L, spec->len == 0 || (spec->len >= 2 && spec->len <= 4), 1,
+        "len must be 2, 3, 4 or varint");
+    luaL_argcheck(L, spec->extra >= 0 && spec->extra <= 4, 1, "extra must be 0-4");
+    luaL_getmetatable(L, FRAME_META);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// zero-copy access for ffi parsers: the pointer stays valid until the buffer
+// is read into or consumed, so use it before yielding.
+// b:peek(n) -> ptr, n with the first n bytes contiguous, nil if fewer are buffered
+static int
+lpeek(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    uint32_t sz = luaL_checkinteger(L, 2);
+    if (sz == 0)
+        return luaL_error(L, "peek(sz) sz need > 0");
+    uint8_t *data = buffer_pullup(p, sz);
+    if (data == NULL) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushlightuserdata(L, data);
+    lua_pushinteger(L, sz);
+    return 2;
+}
+
+// b:view([n]) -> ptr, len of what the first chain holds (at most n), never copies
+static int
+lview(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    uint32_t sz = luaL_optinteger(L, 2, p->total_len);
+    buf_chain_t *chain = p->first;
+    if (p->total_len == 0 || sz == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (sz > chain->off)
+        sz = chain->off;
+    lua_pushlightuserdata(L, chain->buffer + chain->misalign);
+    lua_pushinteger(L, sz);
+    return 2;
+}
+
+// b:consume(n) drops n bytes after a peek/view, returns how many were dropped
+static int
+lconsume(lua_State *L) {
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
+    uint32_t sz = luaL_checkinteger(L, 2);
+    if (sz > p->total_len)
+        sz = p->total_len;
+    buffer_drain(p, sz);
+    p->last_read_pos = p->last_read_pos > sz ? p->last_read_pos - sz : 0;
+    lua_pushinteger(L, sz);
+    return 1;
+}
+
 static int
 lclear(lua_State *L) {
     buffer_t *p = (buffer_t *)luaL_checkudata(L, 1, "gamenet.buffer");
     // printf("%p free chain\n", p);
     buf_chain_free_all(p->first);
+    memset(p, 0, sizeof(*p));
+    p->last_with_datap = &p->first;
     return 0;
 }
 
@@ -168,6 +472,12 @@ lnew (lua_State *L) {
             {"readn", lreadn},
             {"flush", lflush},
             {"clear", lclear},
+            {"peek", lpeek},
+            {"view", lview},
+            {"consume", lconsume},
+            {"readframe", lreadframe},
+            {"watermark", lwatermark},
+            {"size", lsize},
             {NULL, NULL},
         };
         luaL_newlib(L, m);
@@ -177,12 +487,23 @@ lnew (lua_State *L) {
     return 1;
 }
 
+// bytes each chain size class of this loop's cache may keep, 0 disables it
+static int
+lcache_limit(lua_State *L) {
+    buffer_cache_limit(luaL_checkinteger(L, 1));
+    return 0;
+}
+
 static const luaL_Reg lib[] = {
     {"new", lnew},
+    {"cache_limit", lcache_limit},
+    {"framespec", lframespec},
     {NULL, NULL},
 };
 
 int luaopen_gamenet_buffer(lua_State *L) {
+    luaL_newmetatable(L, FRAME_META);
+    lua_pop(L, 1);
     luaL_newlib(L, lib);
     return 1;
 }
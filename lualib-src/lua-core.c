@@ -1,3 +1,8 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include "systime.h"
@@ -8,19 +13,57 @@ lmono(lua_State *L) {
     return 1;
 }
 
+static int
+lmono_ms(lua_State *L) {
+    lua_pushinteger(L, systime_mono_ms());
+    return 1;
+}
+
+static int
+lmono_us(lua_State *L) {
+    lua_pushinteger(L, systime_mono_us());
+    return 1;
+}
+
+static int
+lmono_coarse(lua_State *L) {
+    lua_pushinteger(L, systime_mono_coarse());
+    return 1;
+}
+
 static int
 lwall(lua_State *L) {
     lua_pushinteger(L, systime_wall());
     return 1;
 }
 
+// bind the calling loop thread to one cpu
+static int
+laffinity(lua_State *L) {
+    int cpu = luaL_checkinteger(L, 1);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        lua_pushboolean(L, false);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    lua_pushboolean(L, true);
+    return 1;
+}
+
 // defined in lsha1.c
 int lsha1(lua_State *L);
 int lhmac_sha1(lua_State *L);
 
 static const struct luaL_Reg lib[] = {
     {"mono", lmono},
+    {"mono_ms", lmono_ms},
+    {"mono_us", lmono_us},
+    {"mono_coarse", lmono_coarse},
     {"wall", lwall},
+    {"affinity", laffinity},
     {"sha1", lsha1},
     {"hmac_sha1", lhmac_sha1},
     {NULL, NULL}
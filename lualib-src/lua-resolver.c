@@ -0,0 +1,117 @@
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "resolver.h"
+
+#define RESOLVER_META "gamenet.resolver"
+#define RESULTS_MAX 64
+
+typedef struct {
+    resolver_t *r;
+} lresolver_t;
+
+static resolver_t *
+check_resolver(lua_State *L) {
+    lresolver_t *lr = (lresolver_t *)luaL_checkudata(L, 1, RESOLVER_META);
+    if (lr->r == NULL)
+        luaL_error(L, "resolver already closed");
+    return lr->r;
+}
+
+static int
+lnew(lua_State *L) {
+    lresolver_t *lr = (lresolver_t *)lua_newuserdata(L, sizeof(lresolver_t));
+    lr->r = NULL;
+    luaL_getmetatable(L, RESOLVER_META);
+    lua_setmetatable(L, -2);
+    lr->r = resolver_create();
+    if (lr->r == NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    return 1;
+}
+
+static int
+lfd(lua_State *L) {
+    resolver_t *r = check_resolver(L);
+    lua_pushinteger(L, resolver_fd(r));
+    return 1;
+}
+
+// r:query(host, id)
+static int
+lquery(lua_State *L) {
+    resolver_t *r = check_resolver(L);
+    const char *host = luaL_checkstring(L, 2);
+    int id = luaL_checkinteger(L, 3);
+    if (resolver_query(r, host, id) < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "resolver out of memory");
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// r:results(out) -> n, out = {id1, ip1, err1, ...}, ip or err is false
+static int
+lresults(lua_State *L) {
+    resolver_t *r = check_resolver(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    resolver_result_t res[RESULTS_MAX];
+    int n = resolver_results(r, res, RESULTS_MAX);
+    for (int i = 0; i < n; i++) {
+        lua_pushinteger(L, res[i].id);
+        lua_rawseti(L, 2, 3*i + 1);
+        if (res[i].err == 0) {
+            lua_pushstring(L, res[i].ip);
+            lua_rawseti(L, 2, 3*i + 2);
+            lua_pushboolean(L, 0);
+        } else {
+            lua_pushboolean(L, 0);
+            lua_rawseti(L, 2, 3*i + 2);
+            lua_pushstring(L, gai_strerror(res[i].err));
+        }
+        lua_rawseti(L, 2, 3*i + 3);
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+static int
+lclose(lua_State *L) {
+    lresolver_t *lr = (lresolver_t *)luaL_checkudata(L, 1, RESOLVER_META);
+    if (lr->r) {
+        resolver_free(lr->r);
+        lr->r = NULL;
+    }
+    return 0;
+}
+
+static const luaL_Reg lib[] = {
+    {"new", lnew},
+    {NULL, NULL},
+};
+
+int luaopen_gamenet_resolver(lua_State *L) {
+    if (luaL_newmetatable(L, RESOLVER_META)) {
+        luaL_Reg m[] = {
+            {"fd", lfd},
+            {"query", lquery},
+            {"results", lresults},
+            {"close", lclose},
+            {NULL, NULL},
+        };
+        luaL_newlib(L, m);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lclose);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+    luaL_newlib(L, lib);
+    return 1;
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "buffer.h"
+#include "rudp.h"
+#include "lua-udp.h"
+
+#define RUDP_LMETA "gamenet.rudp"
+#define RECV_CHUNK 4096
+
+// one reliable stream to one peer address, its segments go out through a
+// shared gamenet.udp socket (kept alive through the userdata env)
+typedef struct {
+    rudp_t *r;
+    udp_t *u;
+    int alen;
+    struct sockaddr_storage addr;
+} lrudp_t;
+
+static lrudp_t *
+check_rudp(lua_State *L) {
+    lrudp_t *c = (lrudp_t *)luaL_checkudata(L, 1, RUDP_LMETA);
+    if (c->r == NULL)
+        luaL_error(L, "rudp connection already closed");
+    return c;
+}
+
+static void
+output(const char *buf, int len, void *ud) {
+    lrudp_t *c = (lrudp_t *)ud;
+    if (c->u->fd >= 0)
+        udp_queue(c->u, (const char *)&c->addr, c->alen, buf, len);
+}
+
+// rudp.new(conv, udp, addr)
+static int
+lnew(lua_State *L) {
+    uint32_t conv = (uint32_t)luaL_checknumber(L, 1);
+    udp_t *u = (udp_t *)luaL_checkudata(L, 2, UDP_META);
+    size_t alen;
+    const char *addr = luaL_checklstring(L, 3, &alen);
+    luaL_argcheck(L, conv != 0, 1, "conv must not be 0");
+    luaL_argcheck(L, alen > 0 && alen <= sizeof(struct sockaddr_storage), 3, "bad address");
+    lrudp_t *c = (lrudp_t *)lua_newuserdata(L, sizeof(lrudp_t));
+    memset(c, 0, sizeof(*c));
+    c->u = u;
+    c->alen = alen;
+    memcpy(&c->addr, addr, alen);
+    luaL_getmetatable(L, RUDP_LMETA);
+    lua_setmetatable(L, -2);
+    lua_newtable(L);
+    lua_pushvalue(L, 2);
+    lua_setfield(L, -2, "udp");
+    lua_setfenv(L, -2);
+    c->r = rudp_create(conv, output, c);
+    if (c->r == NULL)
+        return luaL_error(L, "rudp out of memory");
+    // segments must fit the datagrams the udp socket was sized for
+    if (u->size < RUDP_MTU)
+        rudp_setmtu(c->r, u->size);
+    return 1;
+}
+
+// c:config(interval, minrto, fastresend, nodelay), nil keeps the current value
+static int
+lconfig(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    int nodelay = lua_isnoneornil(L, 5) ? -1 : lua_toboolean(L, 5);
+    rudp_config(c->r, luaL_optinteger(L, 2, 0), luaL_optinteger(L, 3, 0),
+        luaL_optinteger(L, 4, -1), nodelay);
+    return 0;
+}
+
+static int
+lwndsize(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    rudp_wndsize(c->r, luaL_optinteger(L, 2, 0), luaL_optinteger(L, 3, 0));
+    return 0;
+}
+
+// c:input(data, now) -> true, or nil, code for a datagram of another conv
+static int
+linput(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    size_t sz;
+    const char *data = luaL_checklstring(L, 2, &sz);
+    uint32_t now = (uint32_t)luaL_checknumber(L, 3);
+    int ret = rudp_input(c->r, data, sz, now);
+    if (ret < 0) {
+        lua_pushnil(L);
+        lua_pushinteger(L, ret);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// c:recv(rbuffer) moves the in-order bytes into a gamenet.buffer, returns n
+static int
+lrecv(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    buffer_t *p = (buffer_t *)luaL_checkudata(L, 2, "gamenet.buffer");
+    int total = 0;
+    int sz;
+    while ((sz = rudp_readable(c->r)) > 0) {
+        // buffer_reserve hands out at most this much contiguous space
+        if (sz > RECV_CHUNK)
+            sz = RECV_CHUNK;
+        uint32_t space;
+        uint8_t *buf = buffer_reserve(p, sz, &space);
+        if (buf == NULL) {
+            lua_pushnil(L);
+            lua_pushstring(L, "cant find continuous space for read");
+            return 2;
+        }
+        int n = rudp_recv(c->r, (char *)buf, sz);
+        if (buffer_commit(p, buf, n) < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, "buffer overflow");
+            return 2;
+        }
+        total += n;
+    }
+    lua_pushinteger(L, total);
+    return 1;
+}
+
+static int
+lsend(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    size_t sz;
+    const char *data = luaL_checklstring(L, 2, &sz);
+    if (rudp_send(c->r, data, sz) < 0)
+        return luaL_error(L, "rudp out of memory");
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int
+lupdate(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    rudp_update(c->r, (uint32_t)luaL_checknumber(L, 2));
+    return 0;
+}
+
+static int
+lfin(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    rudp_fin(c->r);
+    return 0;
+}
+
+// 0 ok, 1 the peer sent fin, -1 the link is dead
+static int
+lstate(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    lua_pushinteger(L, rudp_state(c->r));
+    return 1;
+}
+
+static int
+lwaitsnd(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    lua_pushinteger(L, rudp_waitsnd(c->r));
+    return 1;
+}
+
+static int
+lstats(lua_State *L) {
+    lrudp_t *c = check_rudp(L);
+    const rudp_stat_t *st = rudp_stat(c->r);
+    lua_createtable(L, 0, 7);
+    lua_pushnumber(L, st->out_segs);
+    lua_setfield(L, -2, "out_segs");
+    lua_pushnumber(L, st->in_segs);
+    lua_setfield(L, -2, "in_segs");
+    lua_pushnumber(L, st->retrans);
+    lua_setfield(L, -2, "retrans");
+    lua_pushnumber(L, st->fast_retrans);
+    lua_setfield(L, -2, "fast_retrans");
+    lua_pushnumber(L, st->dup_segs);
+    lua_setfield(L, -2, "dup_segs");
+    lua_pushinteger(L, rudp_rto(c->r));
+    lua_setfield(L, -2, "rto");
+    lua_pushinteger(L, rudp_waitsnd(c->r));
+    lua_setfield(L, -2, "waitsnd");
+    return 1;
+}
+
+static int
+lclose(lua_State *L) {
+    lrudp_t *c = (lrudp_t *)luaL_checkudata(L, 1, RUDP_LMETA);
+    if (c->r) {
+        rudp_free(c->r);
+        c->r = NULL;
+    }
+    return 0;
+}
+
+// rudp.conv(data) -> conv (0 if it isn't a segment), first segment of a stream
+static int
+lconv(lua_State *L) {
+    size_t sz;
+    const char *data = luaL_checklstring(L, 1, &sz);
+    lua_pushnumber(L, rudp_getconv(data, sz));
+    lua_pushboolean(L, rudp_isfirst(data, sz));
+    return 2;
+}
+
+static const luaL_Reg lib[] = {
+    {"new", lnew},
+    {"conv", lconv},
+    {NULL, NULL},
+};
+
+int luaopen_gamenet_rudp(lua_State *L) {
+    if (luaL_newmetatable(L, RUDP_LMETA)) {
+        luaL_Reg m[] = {
+            {"config", lconfig},
+            {"wndsize", lwndsize},
+            {"input", linput},
+            {"recv", lrecv},
+            {"send", lsend},
+            {"update", lupdate},
+            {"fin", lfin},
+            {"state", lstate},
+            {"waitsnd", lwaitsnd},
+            {"stats", lstats},
+            {"close", lclose},
+            {NULL, NULL},
+        };
+        luaL_newlib(L, m);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lclose);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+    luaL_newlib(L, lib);
+    return 1;
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "systime.h"
+#include "ae.h"
+#include "buffer.h"
+#include "lua-stats.h"
+
+#define LOOP_STATS_KEY "gamenet.loop_stats"
+
+static inline int
+hist_bucket(uint64_t v) {
+    if (v < HIST_LINEAR)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    if (msb >= HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    int sub = (v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return HIST_LINEAR + (msb - 4) * (1 << HIST_SUB_BITS) + sub;
+}
+
+// highest value that falls into bucket b
+static uint64_t
+hist_bucket_value(int b) {
+    if (b < HIST_LINEAR)
+        return b;
+    int msb = (b - HIST_LINEAR) / (1 << HIST_SUB_BITS) + 4;
+    int sub = (b - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    return (((uint64_t)(1 << HIST_SUB_BITS) + sub + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+void
+hist_record(histogram_t *h, uint64_t v) {
+    if (h->count == 0 || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    h->sum += v;
+    h->buckets[hist_bucket(v)]++;
+}
+
+static uint64_t
+hist_percentile(histogram_t *h, double q) {
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) {
+            uint64_t v = hist_bucket_value(b);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+loop_stats_t *
+loop_stats(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, LOOP_STATS_KEY);
+    loop_stats_t *st = (loop_stats_t *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (st == NULL) {
+        st = (loop_stats_t *)lua_newuserdata(L, sizeof(loop_stats_t));
+        memset(st, 0, sizeof(*st));
+        st->mark_fd = -1;
+        st->slowest_fd = -1;
+        st->maxevents = AE_MAXEVENT;
+        lua_setfield(L, LUA_REGISTRYINDEX, LOOP_STATS_KEY);
+    }
+    return st;
+}
+
+void
+loop_stats_mark(loop_stats_t *st, int fd) {
+    uint64_t now = systime_mono_us();
+    if (st->mark_fd >= 0) {
+        uint64_t cost = now - st->mark_us;
+        hist_record(&st->handler, cost);
+        if (cost > st->slowest_us) {
+            st->slowest_us = cost;
+            st->slowest_fd = st->mark_fd;
+        }
+    }
+    st->mark_fd = fd;
+    st->mark_us = now;
+}
+
+uint64_t
+loop_stats_poll_begin(loop_stats_t *st) {
+    if (st->mark_fd >= 0)
+        loop_stats_mark(st, -1);
+    uint64_t now = systime_mono_us();
+    if (st->poll_end_us)
+        hist_record(&st->dispatch, now - st->poll_end_us);
+    return now;
+}
+
+void
+loop_stats_poll_end(loop_stats_t *st, uint64_t begin, int nevent) {
+    uint64_t now = systime_mono_us();
+    hist_record(&st->wait, now - begin);
+    hist_record(&st->events, nevent > 0 ? nevent : 0);
+    st->polls++;
+    st->poll_end_us = now;
+}
+
+static void
+push_hist(lua_State *L, histogram_t *h, const char *name) {
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, h->count);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, h->min);
+    lua_setfield(L, -2, "min");
+    lua_pushinteger(L, h->max);
+    lua_setfield(L, -2, "max");
+    lua_pushnumber(L, h->count ? (double)h->sum / h->count : 0);
+    lua_setfield(L, -2, "mean");
+    lua_pushinteger(L, hist_percentile(h, 0.5));
+    lua_setfield(L, -2, "p50");
+    lua_pushinteger(L, hist_percentile(h, 0.9));
+    lua_setfield(L, -2, "p90");
+    lua_pushinteger(L, hist_percentile(h, 0.99));
+    lua_setfield(L, -2, "p99");
+    lua_pushinteger(L, hist_percentile(h, 0.999));
+    lua_setfield(L, -2, "p999");
+    lua_setfield(L, -2, name);
+}
+
+static int
+lmark(lua_State *L) {
+    loop_stats_t *st = (loop_stats_t *)lua_touserdata(L, lua_upvalueindex(1));
+    loop_stats_mark(st, luaL_optinteger(L, 1, -1));
+    return 0;
+}
+
+static int
+lsnapshot(lua_State *L) {
+    loop_stats_t *st = (loop_stats_t *)lua_touserdata(L, lua_upvalueindex(1));
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, st->polls);
+    lua_setfield(L, -2, "polls");
+    lua_pushinteger(L, st->maxevents);
+    lua_setfield(L, -2, "maxevents");
+    lua_pushinteger(L, st->maxevents_grow);
+    lua_setfield(L, -2, "maxevents_grow");
+    lua_pushinteger(L, st->maxevents_shrink);
+    lua_setfield(L, -2, "maxevents_shrink");
+    lua_pushinteger(L, st->spin_hits);
+    lua_setfield(L, -2, "spin_hits");
+    lua_pushinteger(L, st->spin_misses);
+    lua_setfield(L, -2, "spin_misses");
+    uint64_t spins = st->spin_hits + st->spin_misses;
+    lua_pushnumber(L, spins ? (double)st->spin_hits / spins : 0);
+    lua_setfield(L, -2, "spin_hit_ratio");
+    lua_pushinteger(L, st->rejected_rate);
+    lua_setfield(L, -2, "rejected_rate");
+    lua_pushinteger(L, st->rejected_ip);
+    lua_setfield(L, -2, "rejected_ip");
+    buffer_cache_stat_t *cs = buffer_cache_stat();
+    lua_pushinteger(L, cs->hits);
+    lua_setfield(L, -2, "chain_cache_hits");
+    lua_pushinteger(L, cs->misses);
+    lua_setfield(L, -2, "chain_cache_misses");
+    lua_pushinteger(L, cs->releases);
+    lua_setfield(L, -2, "chain_cache_releases");
+    lua_pushinteger(L, cs->cached);
+    lua_setfield(L, -2, "chain_cached");
+    lua_pushinteger(L, cs->cached_bytes);
+    lua_setfield(L, -2, "chain_cached_bytes");
+    push_hist(L, &st->wait, "wait_us");
+    push_hist(L, &st->dispatch, "dispatch_us");
+    push_hist(L, &st->handler, "handler_us");
+    push_hist(L, &st->events, "poll_events");
+    lua_pushinteger(L, st->slowest_fd);
+    lua_setfield(L, -2, "slowest_fd");
+    lua_pushinteger(L, st->slowest_us);
+    lua_setfield(L, -2, "slowest_us");
+    return 1;
+}
+
+static int
+lreset(lua_State *L) {
+    loop_stats_t *st = (loop_stats_t *)lua_touserdata(L, lua_upvalueindex(1));
+    int mark_fd = st->mark_fd, maxevents = st->maxevents;
+    uint64_t mark_us = st->mark_us, poll_end_us = st->poll_end_us;
+    memset(st, 0, sizeof(*st));
+    st->slowest_fd = -1;
+    st->maxevents = maxevents;
+    st->mark_fd = mark_fd;
+    st->mark_us = mark_us;
+    st->poll_end_us = poll_end_us;
+    buffer_cache_stat_t *cs = buffer_cache_stat();
+    cs->hits = cs->misses = cs->releases = 0;
+    return 0;
+}
+
+static const luaL_Reg lib[] = {
+    {"mark", lmark},
+    {"snapshot", lsnapshot},
+    {"reset", lreset},
+    {NULL, NULL},
+};
+
+int luaopen_gamenet_stats(lua_State *L) {
+    lua_createtable(L, 0, sizeof(lib) / sizeof(lib[0]) - 1);
+    lua_pushlightuserdata(L, loop_stats(L));
+    luaL_setfuncs(L, lib, 1);
+    return 1;
+}
@@ -0,0 +1,55 @@
+#ifndef lua_stats_h
+#define lua_stats_h
+
+#include <stdint.h>
+#include <lua.h>
+
+// log-linear buckets: exact below 16, then 8 sub-buckets per power of two
+#define HIST_SUB_BITS 3
+#define HIST_LINEAR 16
+#define HIST_MAX_BITS 41
+#define HIST_BUCKETS (HIST_LINEAR + (HIST_MAX_BITS - 4) * (1 << HIST_SUB_BITS))
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+// per event loop statistics, one per lua vm (and so one per loop thread)
+typedef struct {
+    histogram_t wait;       // usec blocked in ae_poll
+    histogram_t dispatch;   // usec from poll return to the next poll
+    histogram_t handler;    // usec spent in one event handler
+    histogram_t events;     // fired events per poll
+    uint64_t polls;
+    int maxevents;          // current size of the fired array
+    int idle_polls;         // polls in a row that used under a quarter of it
+    uint64_t maxevents_grow;
+    uint64_t maxevents_shrink;
+    uint64_t spin_hits;     // busy-poll windows that found events
+    uint64_t spin_misses;   // ... that fell back to a blocking poll
+    uint64_t rejected_rate; // connections closed by the global accept bucket
+    uint64_t rejected_ip;   // ... by the bucket of their source address
+    uint64_t slowest_us;    // slowest handler since the last reset
+    int slowest_fd;
+    int mark_fd;            // handler being timed, -1 if none
+    uint64_t mark_us;
+    uint64_t poll_end_us;
+} loop_stats_t;
+
+void hist_record(histogram_t *h, uint64_t v);
+
+// the stats of the loop running in this lua vm
+loop_stats_t *loop_stats(lua_State *L);
+
+// called around ae_poll, returns the poll begin time
+uint64_t loop_stats_poll_begin(loop_stats_t *st);
+void loop_stats_poll_end(loop_stats_t *st, uint64_t begin, int nevent);
+
+// start timing the handler of fd (-1 closes the current one)
+void loop_stats_mark(loop_stats_t *st, int fd);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdbool.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "timewheel.h"
+
+#define TIMER_META "gamenet.timer"
+
+static timewheel_t *
+check_wheel(lua_State *L) {
+    timewheel_t **w = (timewheel_t **)luaL_checkudata(L, 1, TIMER_META);
+    if (*w == NULL)
+        luaL_error(L, "timer wheel already freed");
+    return *w;
+}
+
+static int
+ladd(lua_State *L) {
+    timewheel_t *w = check_wheel(L);
+    int64_t delay = luaL_checkinteger(L, 2);
+    uint64_t id = tw_add(w, delay);
+    if (id == 0)
+        return luaL_error(L, "timer wheel out of memory");
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int
+lcancel(lua_State *L) {
+    timewheel_t *w = check_wheel(L);
+    uint64_t id = (uint64_t)luaL_checkinteger(L, 2);
+    lua_pushboolean(L, tw_cancel(w, id));
+    return 1;
+}
+
+typedef struct {
+    lua_State *L;
+    int n;
+} expire_ctx_t;
+
+static void
+push_expired(void *ud, uint64_t handle) {
+    expire_ctx_t *ctx = (expire_ctx_t *)ud;
+    lua_pushinteger(ctx->L, handle);
+    lua_rawseti(ctx->L, 3, ++ctx->n);
+}
+
+// w:expire(now, out) -> n, out[1..n] are the expired ids in expiry order
+static int
+lexpire(lua_State *L) {
+    timewheel_t *w = check_wheel(L);
+    uint64_t now = luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    expire_ctx_t ctx = { L, 0 };
+    tw_expire(w, now, push_expired, &ctx);
+    lua_pushinteger(L, ctx.n);
+    return 1;
+}
+
+static int
+lnext(lua_State *L) {
+    timewheel_t *w = check_wheel(L);
+    lua_pushinteger(L, tw_next(w));
+    return 1;
+}
+
+static int
+lcount(lua_State *L) {
+    timewheel_t *w = check_wheel(L);
+    lua_pushinteger(L, tw_count(w));
+    return 1;
+}
+
+static int
+lgc(lua_State *L) {
+    timewheel_t **w = (timewheel_t **)luaL_checkudata(L, 1, TIMER_META);
+    if (*w) {
+        tw_free(*w);
+        *w = NULL;
+    }
+    return 0;
+}
+
+static int
+lnew(lua_State *L) {
+    uint64_t now = luaL_checkinteger(L, 1);
+    timewheel_t **w = (timewheel_t **)lua_newuserdata(L, sizeof(timewheel_t *));
+    *w = tw_create(now);
+    if (*w == NULL)
+        return luaL_error(L, "create timer wheel failed");
+    if (luaL_newmetatable(L, TIMER_META)) {
+        luaL_Reg m[] = {
+            {"add", ladd},
+            {"cancel", lcancel},
+            {"expire", lexpire},
+            {"next", lnext},
+            {"count", lcount},
+            {NULL, NULL},
+        };
+        luaL_newlib(L, m);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lgc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static const luaL_Reg lib[] = {
+    {"new", lnew},
+    {NULL, NULL},
+};
+
+int luaopen_gamenet_timer(lua_State *L) {
+    luaL_newlib(L, lib);
+    return 1;
+}
@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "anet.h"
+#include "lua-udp.h"
+
+#define UDP_BATCH 64        // datagrams per recvmmsg/sendmmsg
+#define UDP_BATCH_MAX 1024
+#define UDP_SIZE 1500       // largest datagram kept, longer ones are truncated
+#define UDP_SIZE_MAX 65507
+
+static udp_t *
+check_udp(lua_State *L) {
+    udp_t *u = (udp_t *)luaL_checkudata(L, 1, UDP_META);
+    if (u->fd < 0)
+        luaL_error(L, "udp socket already closed");
+    return u;
+}
+
+static void
+udp_free(udp_t *u) {
+    if (u->fd >= 0) {
+        close(u->fd);
+        u->fd = -1;
+    }
+    free(u->rmsgs);
+    free(u->smsgs);
+    free(u->riov);
+    free(u->siov);
+    free(u->raddr);
+    free(u->saddr);
+    free(u->rbuf);
+    free(u->sbuf);
+    u->rmsgs = u->smsgs = NULL;
+    u->riov = u->siov = NULL;
+    u->raddr = u->saddr = NULL;
+    u->rbuf = u->sbuf = NULL;
+}
+
+static int
+udp_alloc(udp_t *u) {
+    int n = u->batch;
+    u->rmsgs = calloc(n, sizeof(struct mmsghdr));
+    u->smsgs = calloc(n, sizeof(struct mmsghdr));
+    u->riov = calloc(n, sizeof(struct iovec));
+    u->siov = calloc(n, sizeof(struct iovec));
+    u->raddr = calloc(n, sizeof(struct sockaddr_storage));
+    u->saddr = calloc(n, sizeof(struct sockaddr_storage));
+    u->rbuf = malloc((size_t)n * u->size);
+    u->sbuf = malloc((size_t)n * u->size);
+    if (!u->rmsgs || !u->smsgs || !u->riov || !u->siov || !u->raddr ||
+        !u->saddr || !u->rbuf || !u->sbuf)
+        return -1;
+    for (int i = 0; i < n; i++) {
+        u->riov[i].iov_base = u->rbuf + (size_t)i * u->size;
+        u->riov[i].iov_len = u->size;
+        u->rmsgs[i].msg_hdr.msg_iov = &u->riov[i];
+        u->rmsgs[i].msg_hdr.msg_iovlen = 1;
+        u->rmsgs[i].msg_hdr.msg_name = &u->raddr[i];
+        u->siov[i].iov_base = u->sbuf + (size_t)i * u->size;
+        u->smsgs[i].msg_hdr.msg_iov = &u->siov[i];
+        u->smsgs[i].msg_hdr.msg_iovlen = 1;
+        u->smsgs[i].msg_hdr.msg_name = &u->saddr[i];
+    }
+    return 0;
+}
+
+// returns the number of datagrams sent, the rest of the queue is dropped
+// when the socket buffer is full, as the network would do
+static int
+udp_flush(udp_t *u, int *dropped) {
+    int sent = 0;
+    *dropped = 0;
+    while (sent < u->nsend) {
+        int n = sendmmsg(u->fd, u->smsgs + sent, u->nsend - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                *dropped += u->nsend - sent;
+                sent = u->nsend;
+                break;
+            }
+            // an icmp error on one peer or a bad datagram: skip just that one
+            (*dropped)++;
+            sent++;
+            continue;
+        }
+        sent += n;
+    }
+    u->nsend = 0;
+    return sent - *dropped;
+}
+
+int
+udp_queue(udp_t *u, const char *addr, int alen, const char *data, int len) {
+    if (len > u->size || alen <= 0 || alen > (int)sizeof(struct sockaddr_storage))
+        return -1;
+    if (u->nsend == u->batch) {
+        int dropped;
+        u->flushed_sent += udp_flush(u, &dropped);
+        u->flushed_dropped += dropped;
+    }
+    int i = u->nsend++;
+    memcpy(&u->saddr[i], addr, alen);
+    u->smsgs[i].msg_hdr.msg_namelen = alen;
+    memcpy(u->siov[i].iov_base, data, len);
+    u->siov[i].iov_len = len;
+    return 0;
+}
+
+// udp.bind(host, port, reuseport, batch, size)
+static int
+lbind(lua_State *L) {
+    const char *host = luaL_optstring(L, 1, NULL);
+    int port = luaL_optinteger(L, 2, 0);
+    int reuseport = lua_toboolean(L, 3);
+    int batch = luaL_optinteger(L, 4, UDP_BATCH);
+    int size = luaL_optinteger(L, 5, UDP_SIZE);
+    luaL_argcheck(L, batch > 0 && batch <= UDP_BATCH_MAX, 4, "batch out of range");
+    luaL_argcheck(L, size > 0 && size <= UDP_SIZE_MAX, 5, "size out of range");
+    int fd = anet_udp_bind(host, port, reuseport);
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    udp_t *u = (udp_t *)lua_newuserdata(L, sizeof(udp_t));
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+    u->batch = batch;
+    u->size = size;
+    luaL_getmetatable(L, UDP_META);
+    lua_setmetatable(L, -2);
+    if (udp_alloc(u) < 0) {
+        udp_free(u);
+        return luaL_error(L, "udp out of memory");
+    }
+    return 1;
+}
+
+static int
+lfd(lua_State *L) {
+    udp_t *u = check_udp(L);
+    lua_pushinteger(L, u->fd);
+    return 1;
+}
+
+// u:recv(out) -> n, truncated, out = {data1, addr1, data2, addr2, ...}
+// datagrams larger than size are dropped and only counted in truncated.
+// 0 when nothing is pending, nil, err on error
+static int
+lrecv(lua_State *L) {
+    udp_t *u = check_udp(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    for (int i = 0; i < u->batch; i++)
+        u->rmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    int n;
+    do {
+        n = recvmmsg(u->fd, u->rmsgs, u->batch, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            lua_pushinteger(L, 0);
+            lua_pushinteger(L, 0);
+            return 2;
+        }
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        struct msghdr *h = &u->rmsgs[i].msg_hdr;
+        if (h->msg_flags & MSG_TRUNC)
+            continue;
+        lua_pushlstring(L, (const char *)h->msg_iov->iov_base, u->rmsgs[i].msg_len);
+        lua_rawseti(L, 2, 2*kept + 1);
+        lua_pushlstring(L, (const char *)h->msg_name, h->msg_namelen);
+        lua_rawseti(L, 2, 2*kept + 2);
+        kept++;
+    }
+    lua_pushinteger(L, kept);
+    lua_pushinteger(L, n - kept);
+    return 2;
+}
+
+// u:send(addr, data) queues one datagram, a full queue is flushed first.
+// returns sent, dropped by that flush (0, 0 when nothing was flushed)
+static int
+lsend(lua_State *L) {
+    udp_t *u = check_udp(L);
+    size_t alen, sz;
+    const char *addr = luaL_checklstring(L, 2, &alen);
+    const char *data = luaL_checklstring(L, 3, &sz);
+    luaL_argcheck(L, alen > 0 && alen <= sizeof(struct sockaddr_storage), 2, "bad address");
+    if ((int)sz > u->size)
+        return luaL_error(L, "datagram too large (%d > %d)", (int)sz, u->size);
+    int sent = 0, dropped = 0;
+    if (u->nsend == u->batch)
+        sent = udp_flush(u, &dropped);
+    udp_queue(u, addr, alen, data, sz);
+    lua_pushinteger(L, sent);
+    lua_pushinteger(L, dropped);
+    return 2;
+}
+
+// u:flush() -> sent, dropped
+static int
+lflush(lua_State *L) {
+    udp_t *u = check_udp(L);
+    int dropped;
+    int sent = udp_flush(u, &dropped) + u->flushed_sent;
+    dropped += u->flushed_dropped;
+    u->flushed_sent = u->flushed_dropped = 0;
+    lua_pushinteger(L, sent);
+    lua_pushinteger(L, dropped);
+    return 2;
+}
+
+static int
+lpending(lua_State *L) {
+    udp_t *u = check_udp(L);
+    lua_pushinteger(L, u->nsend);
+    return 1;
+}
+
+static int
+lclose(lua_State *L) {
+    udp_t *u = (udp_t *)luaL_checkudata(L, 1, UDP_META);
+    udp_free(u);
+    return 0;
+}
+
+// udp.addr(host, port) -> opaque address usable by u:send
+static int
+laddr(lua_State *L) {
+    const char *host = luaL_checkstring(L, 1);
+    int port = luaL_checkinteger(L, 2);
+    struct sockaddr_storage ss;
+    socklen_t len;
+    if (anet_sockaddr(host, port, &ss, &len) < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "bad address %s", host);
+        return 2;
+    }
+    lua_pushlstring(L, (const char *)&ss, len);
+    return 1;
+}
+
+// udp.addr_info(addr) -> ip, port
+static int
+laddr_info(lua_State *L) {
+    size_t len;
+    const char *addr = luaL_checklstring(L, 1, &len);
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    memcpy(&ss, addr, len < sizeof(ss) ? len : sizeof(ss));
+    char ip[INET6_ADDRSTRLEN] = {0};
+    int port = 0;
+    anet_sockaddr_str(&ss, ip, &port);
+    lua_pushstring(L, ip);
+    lua_pushinteger(L, port);
+    return 2;
+}
+
+static const luaL_Reg lib[] = {
+    {"bind", lbind},
+    {"addr", laddr},
+    {"addr_info", laddr_info},
+    {NULL, NULL},
+};
+
+int luaopen_gamenet_udp(lua_State *L) {
+    if (luaL_newmetatable(L, UDP_META)) {
+        luaL_Reg m[] = {
+            {"fd", lfd},
+            {"recv", lrecv},
+            {"send", lsend},
+            {"flush", lflush},
+            {"pending", lpending},
+            {"close", lclose},
+            {NULL, NULL},
+        };
+        luaL_newlib(L, m);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lclose);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_pop(L, 1);
+    luaL_newlib(L, lib);
+    return 1;
+}
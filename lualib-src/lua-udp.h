@@ -0,0 +1,32 @@
+#ifndef lua_udp_h
+#define lua_udp_h
+
+// struct mmsghdr needs _GNU_SOURCE defined before the first system header
+#include <sys/socket.h>
+
+#define UDP_META "gamenet.udp"
+
+// one datagram socket with reusable recv and send batches.
+// addresses cross into lua as opaque sockaddr strings, so a reply is just
+// u:send(addr, data) without formatting or parsing ip strings
+typedef struct {
+    int fd;
+    int batch;
+    int size;
+    int nsend;                      // datagrams queued for the next sendmmsg
+    int flushed_sent;               // sent/dropped by flushes of a full queue,
+    int flushed_dropped;            // reported by the next u:flush()
+    struct mmsghdr *rmsgs;
+    struct mmsghdr *smsgs;
+    struct iovec *riov;
+    struct iovec *siov;
+    struct sockaddr_storage *raddr;
+    struct sockaddr_storage *saddr;
+    char *rbuf;
+    char *sbuf;
+} udp_t;
+
+// queue one datagram for the next flush, returns -1 if it is too large
+int udp_queue(udp_t *u, const char *addr, int alen, const char *data, int len);
+
+#endif
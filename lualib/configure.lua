@@ -2,5 +2,12 @@ local config = {}
 
 config.gateway_port = 8900
 config.chatserver_ports = 8901
+-- gateway和chatserver在同一台机器时可以走unix socket省掉tcp回环，比如"/tmp/gamenet-chatserver.sock"：
+-- 端口为P的chatserver另外监听路径.P，gateway改连这些路径。默认nil只走tcp
+config.chatserver_unix = nil
+-- chatserver的-t线程数，多线程时每个线程监听的路径再加.N，gateway每个都连
+config.chatserver_threads = 1
+-- 透明代理：每个客户端单独连一条chatserver，字节用splice原样转发，不进lua
+config.gateway_proxy = false
 
 return config
@@ -1,6 +1,6 @@
 local core = require "gamenet.core"
 local socket = require "socket"
-local read = socket.read
+local readframe = socket.readframe
 local send = socket.write
 
 local bit = require "bit"
@@ -223,31 +223,18 @@ end
 local function _recv_packet(self)
     local sock = self.sock
 
-    local data, err = read(sock, 4) -- packet header
+    -- 3 byte length and the sequence number, the reader wakes up once per packet
+    local data, num = readframe(sock, self._frame)
     if not data then
-        return nil, nil, "failed to receive packet header: " .. err
+        return nil, nil, "failed to receive packet: " .. num
     end
 
-    local len, pos = _get_byte3(data, 1)
-
-    if len == 0 then
+    if #data == 0 then
         return nil, nil, "empty packet"
     end
 
-    if len > self._max_packet_size then
-        return nil, nil, "packet size too big: " .. len
-    end
-
-    local num = strbyte(data, pos)
-
     self.packet_no = num
 
-    data, err = read(sock, len)
-
-    if not data then
-        return nil, nil, "failed to read packet content: " .. err
-    end
-
     local field_count = strbyte(data, 1)
 
     local typ
@@ -706,6 +693,7 @@ local function connect(self, host, port, opts)
         max_packet_size = 1024 * 1024 -- default 1 MB
     end
     self._max_packet_size = max_packet_size
+    self._frame = { len = 3, endian = "le", extra = 1, max = max_packet_size }
 
     local fd, err
 
@@ -1,12 +1,20 @@
 
 local socket = require "socket"
 local game = require "game"
+local core = require "gamenet.core"
 
 local _M = {}
 
 local aefd, stop
-function _M.start(endpoint, on_accept)
-    aefd = socket.new_poll()
+-- opts.edge_trigger: register client sockets edge-triggered and drain them in C
+-- opts.cpu: bind this loop thread to a cpu
+-- opts.max_events: upper bound of events fetched by one poll (default 4096)
+-- opts.backlog/accept_batch/defer_accept: see socket.listen
+function _M.start(endpoint, on_accept, opts)
+    if opts and opts.cpu then
+        assert(core.affinity(opts.cpu))
+    end
+    aefd = socket.new_poll(opts)
     game.init_timer()
     if not endpoint and not on_accept then
         print("just to be a client")
@@ -14,17 +22,34 @@ function _M.start(endpoint, on_accept)
     end
     assert(type(endpoint) == "string", "your need provide `host:port`(string type) for listennig")
     assert(type(on_accept) == "function", "your need provide a function to accept a client")
-    socket.listen(endpoint, on_accept)
+    socket.listen(endpoint, on_accept, opts)
 end
 
+-- 当前线程事件循环的统计信息
+_M.stats = socket.stats
+
 function _M.stop()
     stop = true
 end
 
-function _M.run()
+-- opts.spin_us: busy poll for this many usec before blocking in epoll_wait
+-- opts.busy_poll: set SO_BUSY_POLL (usec) on accepted sockets
+function _M.run(opts)
     assert(aefd, "please call evloop.start first!")
+    if opts then
+        socket.set_busy_poll(opts.spin_us, opts.busy_poll)
+    end
     while not stop do
-        socket.event_wait(game.expire_timer())
+        local timeout = game.expire_timer()
+        -- a timer may have stopped the loop, don't block in poll
+        if stop then
+            break
+        end
+        local ok, err = socket.event_wait(timeout)
+        if not ok then
+            socket.free_poll()
+            error("event loop poll failed: " .. err)
+        end
     end
     socket.free_poll()
 end
@@ -1,4 +1,5 @@
 local core = require "gamenet.core"
+local timer = require "gamenet.timer"
 local new_tab = require "table.new"
 local math_floor = math.floor
 local tab_remove = table.remove
@@ -48,100 +49,36 @@ local function co_runfd(co)
     return caller[co or coroutine_running()]
 end
 
---[[
-    minheap = {ele1, ele2, ele3, ...}
-    ele = {idx, time, func}
-]]
-local minheap = {}
-local nele = 0
-
-local function min_heap_elem_greater(lht, rht)
-    return lht[2] > rht[2]
-end
-
-local function min_heap_shift_up(idx)
-    local parent = math_floor(idx/2)
-    while parent > 0 and min_heap_elem_greater(minheap[parent], minheap[idx]) do
-        minheap[parent], minheap[idx] = minheap[idx], minheap[parent]
-        minheap[parent][1], minheap[idx][1] = minheap[idx][1], minheap[parent][1]
-        idx = parent
-        parent = math_floor(idx/2)
-    end
-    return idx
-end
-
-local function min_heap_shift_up_unconditional(idx)
-    local parent = math_floor(idx/2)
-    repeat
-        minheap[parent], minheap[idx] = minheap[idx], minheap[parent]
-        minheap[parent][1], minheap[idx][1] = minheap[idx][1], minheap[parent][1]
-        idx = parent
-        parent = math_floor(idx/2)
-    until parent > 0 and min_heap_elem_greater(minheap[parent], minheap[idx])
-end
-
-local function min_heap_shift_down(idx)
-    local min_child = 2 * idx
-    while min_child <= nele do
-        if min_child+1 <= nele and min_heap_elem_greater(minheap[min_child], minheap[min_child+1]) then
-            min_child = min_child + 1
-        end
-        if min_heap_elem_greater(minheap[min_child], minheap[idx]) then
-            break
-        end
-        minheap[min_child], minheap[idx] = minheap[idx], minheap[min_child]
-        minheap[min_child][1], minheap[idx][1] = minheap[idx][1], minheap[min_child][1]
-        idx = min_child
-        min_child = 2 * idx
-    end
-end
-
-local function min_heap_erase(ele)
-    local idx = ele[1]
-    minheap[idx] = minheap[nele]
-    minheap[idx][1] = idx
-    minheap[nele] = nil
-    if nele == idx then -- delete last element
-        nele = nele - 1
-        return
-    end
-    nele = nele - 1
-    if nele < 2 then return end
-    local parent = math_floor(idx/2)
-    if parent > 0 and min_heap_elem_greater(minheap[parent], minheap[idx]) then
-        min_heap_shift_up_unconditional(idx)
-    else
-        min_heap_shift_down(idx)
-    end
-end
-
-local function min_heap_top()
-    return minheap[1]
-end
-
-local function min_heap_pop()
-    if nele > 0 then
-        min_heap_erase(minheap[1])
-    end
-end
-
--- local function dump_timer(desc)
---     for i=1, nele do
---         print(("%s=>idx=%d,expire=%d"):format(desc, minheap[i][1], minheap[i][2]))
---     end
--- end
 local now_time
 local now_tick
 
+local start_time, start_tick
+
+--[[
+    timing wheel in c, ticks are msec of the monotonic clock
+    timer_co = {id = coroutine}, expired ids are collected into `expired`
+]]
+local wheel
+local timer_co = {}
+local expired = new_tab(64, 0)
+
 function _M.init_timer()
     now_time = core.wall()
-    now_tick = core.mono()
+    now_tick = core.mono_coarse()
+    start_time, start_tick = now_time, now_tick
+    wheel = timer.new(now_tick)
 end
 
+-- cached wall time in csec
 function _M.time()
     return now_time
 end
 
+-- cached monotonic time in msec
+function _M.now()
+    return now_tick
+end
+
 function _M.real_time()
     return core.wall()
 end
@@ -156,61 +93,68 @@ local function safe_call_timer(func)
     end
 end
 
+local function add_timer_ms(msec, func)
+    local id = wheel:add(msec)
+    timer_co[id] = co_create(safe_call_timer(func))
+    return id
+end
+
 local function add_timer(csec, func)
-    local ele = new_tab(3, 0)
-    nele = nele+1
-    ele[1], ele[2], ele[3] = nele, now_tick + csec, co_create(safe_call_timer(func))
-    -- print("add timer", csec, ele[2])
-    minheap[nele] = ele
-    local idx = min_heap_shift_up(nele)
-    -- dump_timer("add_timer")
-    return minheap[idx]
+    return add_timer_ms(csec * 10, func)
 end
 
-local function del_timer(ele)
-    min_heap_erase(ele)
-    coroutine_resume(ele[3], true)
-    -- dump_timer("del_timer")
+local function del_timer(id)
+    local co = timer_co[id]
+    if co == nil then
+        return
+    end
+    -- a timer of the batch being expired is off the wheel already but
+    -- hasn't run yet, dropping it from timer_co is what skips it
+    wheel:cancel(id)
+    timer_co[id] = nil
+    coroutine_resume(co, true)
 end
 
+-- once per loop iteration, the cheap clock is enough for msec ticks
 local function update_cache_time()
-    local last_tick = now_tick
-    now_tick = core.mono()
-    local diff = now_tick - last_tick
-    now_time = now_time + diff
+    now_tick = core.mono_coarse()
+    now_time = start_time + math_floor((now_tick - start_tick) / 10)
 end
 
 local function expire_timer()
-    while true do
-        if nele == 0 then
-            return -1
-        end
-        local ele = min_heap_top()
-        local diff = ele[2] - now_tick
-        if diff >= 0 then
-            return diff * 10
+    local n = wheel:expire(now_tick, expired)
+    for i = 1, n do
+        local id = expired[i]
+        local co = timer_co[id]
+        -- nil once an earlier callback of this batch cancelled it
+        if co then
+            timer_co[id] = nil
+            coroutine_resume(co)
         end
-        -- print("expire timer", now_tick)
-        min_heap_pop()
-        coroutine_resume(ele[3])
-        -- dump_timer("expire_timer")
     end
+    -- msec until the next timer, used as poll timeout
+    return wheel:next()
 end
 
 function _M.fork(func)
     add_timer(0, func)
 end
 
-function _M.sleep(csec)
+local function sleep_ms(msec)
     local running = coroutine_running()
     caller[running] = -1
-    add_timer(csec, function ()
-        coroutine_resume(running)
-    end)
+    -- the sleeping coroutine is resumed by the wheel directly
+    timer_co[wheel:add(msec)] = running
     coroutine_yield()
     caller[running] = nil
 end
 
+function _M.sleep(csec)
+    sleep_ms(csec * 10)
+end
+
+_M.sleep_ms = sleep_ms
+
 _M.co_create = co_create
 _M.co_yield = coroutine_yield
 _M.co_resume = coroutine_resume
@@ -219,6 +163,7 @@ _M.co_attach = co_attach
 _M.co_detach = co_detach
 _M.co_runfd = co_runfd
 _M.add_timer = add_timer
+_M.add_timer_ms = add_timer_ms
 _M.del_timer = del_timer
 _M.update_cache_time = update_cache_time
 _M.expire_timer = expire_timer
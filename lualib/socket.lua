@@ -1,17 +1,35 @@
 local ae = require "gamenet.ae"
 local anet = require "gamenet.anet"
 local buffer = require "gamenet.buffer"
+local cstats = require "gamenet.stats"
+local udp = require "gamenet.udp"
+local rudp = require "gamenet.rudp"
+local resolver = require "gamenet.resolver"
 local game = require "game"
+local bit = require "bit"
+local ffi = require "ffi"
+local new_tab = require "table.new"
 
+local band = bit.band
 local tab_isempty = require "table.isempty"
 local tab_isarray = require "table.isarray"
 local tab_remove = table.remove
 local tab_concat = table.concat
 local traceback = debug.traceback
+local u8ptr = ffi.typeof("const uint8_t *")
+local ffi_cast = ffi.cast
 
 local _M = {}
 local AE_READABLE = 1
 local AE_WRITABLE = 2
+local AE_ERR = 4
+local AE_MAXEVENT = 64
+local AE_MAXEVENT_LIMIT = 4096
+local LISTEN_BACKLOG = 1024
+local ACCEPT_BATCH = 64
+local CONNECT_TIMEOUT = 5000    -- msec, name lookup included
+local DNS_TTL = 60000           -- msec a lookup is cached
+local DNS_NEG_TTL = 5000        -- ... a failed one
 
 local socket_pool = setmetatable({},{
     __gc = function(tab)
@@ -23,7 +41,72 @@ local socket_pool = setmetatable({},{
 
 local connection_pool = {}
 
+-- per-loop counters, each loop thread has its own vm so no locking is needed
+local loop_stats = {
+    polls = 0,
+    events = 0,
+    accepts = 0,
+    sockets = 0,
+    udp_rx = 0,
+    udp_tx = 0,
+    udp_drops = 0,
+    udp_truncated = 0,  -- datagrams larger than the recv size, dropped
+    rudp_conns = 0,
+    cork_writes = 0,    -- writes queued in corked mode
+    cork_syscalls = 0,  -- writev calls that flushed them
+    backpressure_high = 0,  -- write backlogs that crossed their high watermark
+    write_suspends = 0,     -- writers suspended until the backlog drained
+    slow_drops = 0,         -- connections dropped for their backlog
+    forward_bytes = 0,      -- bytes spliced by socket.forward
+}
+
+-- udp sockets with queued datagrams, flushed with sendmmsg once per loop iteration
+local udp_dirty = {}
+local udp_ndirty = 0
+
+-- reliable udp streams use ids above any fd, id -> socket
+local RUDP_ID_BASE = 0x40000000
+local rudp_next_id = RUDP_ID_BASE
+local rudp_conns = {}
+-- streams with queued writes or acks, updated once per loop iteration
+local rudp_dirty = {}
+local rudp_spare = {}
+local rudp_ndirty = 0
+-- streams updated by one tick, taken before any of them runs
+local rudp_round = {}
+local rudp_interval = 10
+local rudp_ticking = false
+local rudp_seeded = false
+
+-- hostname lookups run on a resolver thread started by the first one
+local dns
+local dns_cache = {}        -- host -> {ip, err, expire}
+local dns_pending = {}      -- host -> {co = true} waiting for the lookup
+local dns_queries = {}      -- query id -> host
+local dns_next_id = 0
+local dns_results = new_tab(64 * 3, 0)
+
 local aefd
+local edge_trigger = false
+-- upper bound of the fired array, the c side grows it from AE_MAXEVENT on bursts
+local max_events = AE_MAXEVENT_LIMIT
+-- busy-poll window before a blocking poll, and SO_BUSY_POLL for accepted sockets
+local spin_us = 0
+local busy_poll
+-- corked mode: writes only queue, dirty connections are flushed once per
+-- loop iteration with writev (and TCP_CORK when a backlog needs several)
+local cork_writes = false
+local tcp_cork = false
+local cork_dirty = {}
+local cork_spare = {}
+local cork_ndirty = 0
+-- default write watermarks of new connections, see socket.watermark
+local write_high = 0
+local write_low = 0
+local on_backpressure = "suspend"
+
+local rudp_close
+local forward_done
 
 local function close(fd)
     local s = socket_pool[fd]
@@ -32,9 +115,18 @@ local function close(fd)
             s.rbuffer:clear()
         end
         if s.wbuffer then
+            -- what corked writes queued still goes out, best effort
+            if cork_dirty[fd] then
+                cork_dirty[fd] = nil
+                cork_ndirty = cork_ndirty - 1
+                s.wbuffer:flush(fd, true)
+            end
             s.wbuffer:clear()
         end
         socket_pool[fd] = nil
+        if s.rudp then
+            return rudp_close(s)
+        end
         if s.pool_name then
             local spool = connection_pool[s.pool_name]
             if s.status and spool[s.status] then
@@ -42,7 +134,36 @@ local function close(fd)
             end
         end
         ae.del(aefd, fd)
-        anet.close(fd)
+        if s.udp then
+            if udp_dirty[fd] then
+                udp_dirty[fd] = nil
+                udp_ndirty = udp_ndirty - 1
+                s.udp:flush()
+            end
+            s.udp:close()
+        else
+            anet.close(fd)
+        end
+        loop_stats.sockets = loop_stats.sockets - 1
+        -- wake up whoever waited on fd only once it is gone, they
+        -- usually close the other end and may come back here
+        if s.write_waiters then
+            local waiters = s.write_waiters
+            s.write_waiters = nil
+            for _, co in ipairs(waiters) do
+                game.co_resume(co, nil, "closed")
+            end
+        end
+        if s.fwd_out then
+            forward_done(s.fwd_out, "closed")
+        end
+        if s.fwd_in then
+            forward_done(s.fwd_in, "closed")
+        end
+        -- a reader parked in udp_recv detaches itself and returns nil, "closed"
+        if s.udp and s.co and game.co_runfd(s.co) == fd then
+            game.co_resume(s.co, nil, "closed")
+        end
     end
 end
 
@@ -54,8 +175,67 @@ local option_idx = {
     ["tcp-nodelay"] = 3,
     ["sndbuf"]      = 4,
     ["rcvbuf"]      = 5,
+    ["reuseport"]   = 6,
+    ["busy-poll"]   = 7,
+    ["defer-accept"] = 8,
+    ["quickack"]    = 9,
+    ["fastopen"]    = 10,
+    ["user-timeout"] = 11,
+    ["notsent-lowat"] = 12,
+    ["keepidle"]    = 13,
+    ["keepintvl"]   = 14,
+    ["keepcnt"]     = 15,
+    ["cork"]        = 16,
 }
 
+-- option sets for opts.profile of listen/connect, applied in c to every
+-- accepted or connected socket. add your own, a profile is frozen on first use
+local profiles = {
+    -- players: small writes leave at once, a dead peer is dropped within seconds
+    low_latency = {
+        ["tcp-nodelay"] = 1,
+        ["quickack"] = 1,
+        ["notsent-lowat"] = 16384,
+        ["user-timeout"] = 10000,
+        ["keepalive"] = 1,
+        ["keepidle"] = 30,
+        ["keepintvl"] = 5,
+        ["keepcnt"] = 3,
+    },
+    -- links between services: throughput over latency
+    bulk = {
+        ["sndbuf"] = 4 * 1024 * 1024,
+        ["rcvbuf"] = 4 * 1024 * 1024,
+        ["keepalive"] = 1,
+        ["keepidle"] = 60,
+        ["keepintvl"] = 10,
+        ["keepcnt"] = 6,
+    },
+}
+_M.profiles = profiles
+
+local cprofiles = setmetatable({}, { __mode = "k" })
+
+-- profile name or table -> option table, anet profile
+local function get_profile(p)
+    if p == nil then
+        return nil
+    end
+    if type(p) == "string" then
+        p = assert(profiles[p], "unknown socket profile " .. p)
+    end
+    local cp = cprofiles[p]
+    if not cp then
+        local vals = {}
+        for name, v in pairs(p) do
+            vals[assert(option_idx[name], "unsupported option " .. tostring(name))] = v
+        end
+        cp = anet.profile(vals)
+        cprofiles[p] = cp
+    end
+    return p, cp
+end
+
 local function setoption(fd, option, value)
     if option == nil then
         return false, 'missing the "option" argument'
@@ -100,50 +280,166 @@ local function ev_listen_handler(s, readable, writable, _)
     end
 end
 
+local function on_read_error(s, err)
+    if s.close_cb then
+        s.close_cb()
+    end
+    -- writers parked by backpressure won't see the backlog drain any more
+    if s.write_waiters then
+        local waiters = s.write_waiters
+        s.write_waiters = nil
+        for _, co in ipairs(waiters) do
+            game.co_resume(co, nil, err)
+        end
+    end
+    if s.fd == game.co_runfd(s.co) then
+        return game.co_resume(s.co, nil, err)
+    else
+        s.errmsg = err
+    end
+end
+
+-- resume the reader once rbuffer holds the line or the bytes it waits for
+local function wakeup_reader(s)
+    if s.fd ~= game.co_runfd(s.co) then
+        return
+    end
+    local need = s.read_need
+    local tp = type(need)
+    local buf, len
+    if tp == "string" then
+        buf = s.rbuffer:readline(need)
+    elseif tp == "userdata" then
+        -- only a whole frame (or a bad header) wakes the reader
+        buf, len = s.rbuffer:readframe(need)
+        if buf == false then
+            return game.co_resume(s.co, nil, len)
+        elseif buf ~= nil then
+            return game.co_resume(s.co, buf, len)
+        end
+    elseif s.read_view then
+        buf, len = s.rbuffer[s.read_view](s.rbuffer, need)
+        if buf ~= nil then
+            return game.co_resume(s.co, ffi_cast(u8ptr, buf), len)
+        end
+    elseif tp == "number" then
+        buf = s.rbuffer:readn(need)
+    end
+    if buf ~= nil then
+        game.co_resume(s.co, buf)
+    end
+end
+
+-- the write backlog of s crossed a watermark: "high" or "low"
+local function backpressure(s, state)
+    local policy = s.wm_policy
+    if state == "high" then
+        loop_stats.backpressure_high = loop_stats.backpressure_high + 1
+    end
+    if type(policy) == "function" then
+        return policy(s.fd, s.wbuffer:size(), state)
+    end
+    if state == "low" and s.write_waiters then
+        local waiters = s.write_waiters
+        s.write_waiters = nil
+        for _, co in ipairs(waiters) do
+            game.co_resume(co, true)
+        end
+    end
+end
+
+-- readiness a connection waits for: reads pause while the bytes it forwards
+-- are stuck on the other side, writes wait for wbuffer or an incoming forward
+local function update_events(s)
+    if edge_trigger then
+        return
+    end
+    local out, into = s.fwd_out, s.fwd_in
+    ae.enable(aefd, s.fd, not (out and out.state == "write"),
+        s.writable or (into ~= nil and into.state == "write"))
+end
+
+function forward_done(f, err)
+    if f.state == "done" then
+        return
+    end
+    local s, d = f.src, f.dst
+    s.fwd_out, d.fwd_in = nil, nil
+    f.pump:close()
+    f.state = "done"
+    f.err = err
+    if socket_pool[s.fd] == s then
+        update_events(s)
+    end
+    if socket_pool[d.fd] == d then
+        update_events(d)
+    end
+    if f.waiting then
+        game.co_resume(f.co)
+    end
+end
+
+-- splice until src is drained or dst is full, then wait for that side
+local function forward_run(f)
+    local d = f.dst
+    local state, err, moved
+    -- bytes written to dst before go out first, its flush runs us again
+    if d.wbuffer:size() > 0 then
+        state = "write"
+    else
+        state, err, moved = f.pump:run(f.src.fd, d.fd)
+        if state then
+            moved, err = err, nil
+        end
+        f.bytes = f.bytes + moved
+        loop_stats.forward_bytes = loop_stats.forward_bytes + moved
+        if state == nil or state == "eof" then
+            return forward_done(f, err)
+        end
+    end
+    if state ~= f.state then
+        f.state = state
+        update_events(f.src)
+        update_events(d)
+    end
+end
+
 local function ev_client_handler(s, readable, writable, _)
     assert(s)
-    local runfd = assert(game.co_runfd(s.co))
-    if readable then
+    if readable and s.fwd_out then
+        forward_run(s.fwd_out)
+    elseif readable then
         local sz = s.read_step
-        local n, err = s.rbuffer:read(s.fd, sz)
+        -- in edge-triggered mode rbuffer:read drains the socket until EAGAIN
+        local n, err = s.rbuffer:read(s.fd, sz, edge_trigger)
         if not n then
-            if s.close_cb then
-                s.close_cb()
-            end
-            if s.fd == runfd then
-                return game.co_resume(s.co, n, err)
-            else
-                s.errmsg = err
-                return
-            end
+            return on_read_error(s, err)
         end
         if n > 0 then
-            if s.fd == runfd then
-                local tp = type(s.read_need)
-                if tp == "string" then
-                    local buf = s.rbuffer:readline(s.read_need)
-                    if buf ~= nil then
-                        game.co_resume(s.co, buf)
-                    end
-                elseif tp == "number" then
-                    local buf = s.rbuffer:readn(s.read_need)
-                    if #buf >= s.read_need then
-                        game.co_resume(s.co, buf)
-                    end
-                end
-            end
+            wakeup_reader(s)
             if n == sz and sz < 2048 then
                 s.read_step = s.read_step * 2;
             elseif n > 64 and n*2 < sz then
                 s.read_step = s.read_step / 2;
             end
         end
+        -- peer closed right after the drained bytes
+        if err and socket_pool[s.fd] == s then
+            return on_read_error(s, err)
+        end
     end
-    if writable then
-        local ok = s.wbuffer:flush(s.fd)
+    if writable and socket_pool[s.fd] == s then
+        local ok, _, wm = s.wbuffer:flush(s.fd, edge_trigger)
         if s.writable and ok then
             s.writable = false
-            ae.enable(aefd, s.fd, true, false)
+            update_events(s)
+        end
+        -- after the bookkeeping above, a resumed writer may queue again
+        if wm then
+            backpressure(s, wm)
+        end
+        if s.fwd_in then
+            forward_run(s.fwd_in)
         end
     end
 end
@@ -166,16 +462,51 @@ local function ev_pool_connect_handler(s, _, _, errevent)
     end
 end
 
+local function ev_udp_handler(s, readable, _, _)
+    if readable and s.co and s.fd == game.co_runfd(s.co) then
+        game.co_resume(s.co)
+    end
+end
+
+local function ev_resolver_handler(_, readable, _, _)
+    if not readable then
+        return
+    end
+    local n = dns:results(dns_results)
+    local now = game.now()
+    for i = 1, n * 3, 3 do
+        local host = dns_queries[dns_results[i]]
+        local ip, err = dns_results[i+1] or nil, dns_results[i+2] or nil
+        dns_queries[dns_results[i]] = nil
+        dns_cache[host] = { ip = ip, err = err, expire = now + (ip and DNS_TTL or DNS_NEG_TTL) }
+        local waiters = dns_pending[host]
+        dns_pending[host] = nil
+        for co in pairs(waiters) do
+            waiters[co] = nil
+            game.co_resume(co, ip, err)
+        end
+    end
+end
+
 local event_handler = {
     base = ev_base_handler,
     listen = ev_listen_handler,
     client = ev_client_handler,
     connect = ev_connect_handler,
     pool_connect = ev_pool_connect_handler,
+    udp = ev_udp_handler,
+    resolver = ev_resolver_handler,
 }
 
-function _M.new_poll()
+function _M.new_poll(opts)
     aefd = ae.create()
+    edge_trigger = opts and opts.edge_trigger or false
+    max_events = opts and opts.max_events or AE_MAXEVENT_LIMIT
+    cork_writes = opts and opts.cork and true or false
+    tcp_cork = opts and opts.cork == "tcp" or false
+    write_high = opts and opts.write_high or 0
+    write_low = opts and opts.write_low or math.floor(write_high / 2)
+    on_backpressure = opts and opts.on_backpressure or "suspend"
     ae.register({
         update_time = game.update_cache_time,
         ev_handler = event_handler.base,
@@ -187,19 +518,84 @@ function _M.free_poll()
     return ae.close(aefd)
 end
 
-function _M.listen(endpoint, on_accept)
-    local host, port = endpoint:match("([^:]+):(.+)$")
-    print("listen:", host, port)
-    port = tonumber(port)
-    local fd = anet.listen(host, port, 32)
+-- "host:port", "[v6 address]:port" or "unix:/path", returns host, port or nil, path
+local function parse_endpoint(endpoint)
+    local path = endpoint:match("^unix:(.+)$")
+    if path then
+        return nil, path
+    end
+    local host, port = endpoint:match("^%[(.+)%]:(%d+)$")
+    if not host then
+        host, port = endpoint:match("^(.+):(%d+)$")
+    end
+    return host, tonumber(port)
+end
+
+-- host may be "unix:/path" (port is ignored) or a v4/v6 address
+local function raw_connect(host, port, profile)
+    local path = host:match("^unix:(.+)$")
+    if path then
+        return anet.unix_connect(path)
+    end
+    return anet.connect(host:match("^%[(.+)%]$") or host, port, profile)
+end
+
+-- opts.backlog: listen backlog, the kernel caps it at net.core.somaxconn
+-- opts.accept_batch: max connections accepted per readiness
+-- opts.defer_accept: TCP_DEFER_ACCEPT seconds, wake up only once data arrives
+-- opts.profile: name in socket.profiles or an option table for accepted sockets,
+-- its "fastopen" is the fast open queue length of the listener
+-- opts.admission: {rate, burst, ip_rate, ip_burst, slots} token buckets per second,
+-- connections over them are reset in c and counted in stats rejected_rate/rejected_ip
+function _M.listen(endpoint, on_accept, opts)
+    local host, port = parse_endpoint(endpoint)
+    print("listen:", host or "unix", port)
+    opts = opts or {}
+    local backlog = opts.backlog or LISTEN_BACKLOG
+    local batch = opts.accept_batch or ACCEPT_BATCH
+    local nthread = GAMENET_NTHREAD or 1
+    local fd
+    if host then
+        -- with several loop threads every loop opens its own SO_REUSEPORT listener
+        fd = anet.listen(host, port, backlog, nthread > 1)
+    else
+        -- a unix path can't be shared, every loop thread gets path.N
+        if nthread > 1 then
+            port = port .. "." .. GAMENET_THREAD
+        end
+        fd = anet.unix_listen(port, backlog)
+    end
+    if opts.defer_accept then
+        setoption(fd, "defer-accept", opts.defer_accept)
+    end
+    -- tcp options mean nothing to unix sockets
+    local profile, cprofile, admission
+    if host then
+        profile, cprofile = get_profile(opts.profile)
+        -- each loop thread has its own buckets
+        admission = opts.admission and anet.admission(opts.admission)
+    end
+    if profile and profile.fastopen then
+        setoption(fd, "fastopen", profile.fastopen)
+    end
+    local accepted = new_tab(batch * 3, 0)
     local co = game.co_create(function ()
         while true do
-            local clientfd, ip, clientport = anet.accept(fd)
-            if clientfd == 0 then
-                game.co_yield()
-            else
-                on_accept(clientfd, ip, clientport)
+            -- level-triggered: whatever is left over fires again next poll
+            local n, err = anet.accept_batch(fd, batch, accepted, cprofile, admission)
+            if not n then
+                print("accept error:", err)
+                n = 0
             end
+            loop_stats.accepts = loop_stats.accepts + n
+            for i = 1, n * 3, 3 do
+                local clientfd = accepted[i]
+                if busy_poll then
+                    setoption(clientfd, "busy-poll", busy_poll)
+                end
+                on_accept(clientfd, accepted[i+1], accepted[i+2])
+            end
+            game.co_yield()
         end
     end)
     local s = {
@@ -208,37 +604,60 @@ function _M.listen(endpoint, on_accept)
         ev_handler = event_handler.listen,
     }
     socket_pool[fd] = s
+    loop_stats.sockets = loop_stats.sockets + 1
     setoption(fd, "tcp-nodelay", 1)
     ae.add_read(aefd, fd)
     return fd
 end
 
+-- logic runs in a new coroutine, without it the running coroutine becomes the reader
 local function bind(fd, logic)
     local co = game.co_running()
     local s = socket_pool[fd]
-    if s ~= nil then
-        ae.enable(aefd, fd, true, false)
+    if logic then
+        assert(type(logic) == "function")
+        co = game.co_create(function ()
+            local ok, err = xpcall(logic, traceback, fd)
+            if not ok then
+                print(err)
+                close(fd)
+            end
+        end)
+    end
+    if s ~= nil and s.rudp then
+        -- no readiness to register, input from the udp socket feeds rbuffer
+        s.co = co
+    elseif s ~= nil then
+        if edge_trigger then
+            ae.del(aefd, fd)
+            ae.add_read_et(aefd, fd)
+        else
+            ae.enable(aefd, fd, true, false)
+        end
         s.co = co
         s.read_need = false
+        s.read_view = false
         s.read_step = 64
         s.rbuffer = buffer.new()
         s.wbuffer = buffer.new()
         s.writeable = false
         s.ev_handler = ev_client_handler
+        if write_high > 0 then
+            s.wbuffer:watermark(write_high, write_low)
+            s.wm_policy = on_backpressure
+        end
     else
-        assert(logic and type(logic) == "function")
-        co = game.co_create(function ()
-            local ok, err = xpcall(logic, traceback, fd)
-            if not ok then
-                print(err)
-                close(fd)
-            end
-        end)
-        ae.add_read(aefd, fd)
+        assert(logic, "bind a new fd needs a logic function")
+        if edge_trigger then
+            ae.add_read_et(aefd, fd)
+        else
+            ae.add_read(aefd, fd)
+        end
         socket_pool[fd] = {
             fd = fd,
             co = co,
             read_need = false,
+            read_view = false,
             read_step = 64,
             rbuffer = buffer.new(),
             wbuffer = buffer.new(),
@@ -246,6 +665,13 @@ local function bind(fd, logic)
             ev_handler = event_handler.client,
             errmsg = nil,
         }
+        if write_high > 0 then
+            socket_pool[fd].wbuffer:watermark(write_high, write_low)
+            socket_pool[fd].wm_policy = on_backpressure
+        end
+        loop_stats.sockets = loop_stats.sockets + 1
+    end
+    if logic then
         game.co_resume(co)
     end
 end
@@ -294,6 +720,74 @@ function _M.read(fd, sz)
     return ok, err
 end
 
+local cframespecs = setmetatable({}, { __mode = "k" })
+
+-- frame = {len = 2|3|4|"varint", endian = "be"|"le", extra = 0, include = false, max = 1M}
+-- body, extra once the whole frame is buffered, extra holds the header bytes
+-- after the length. nil, err for a malformed or oversized frame
+function _M.readframe(fd, frame)
+    local s = assert(socket_pool[fd])
+    if s.errmsg then
+        return nil, s.errmsg
+    end
+    local spec = cframespecs[frame]
+    if not spec then
+        spec = buffer.framespec(frame)
+        cframespecs[frame] = spec
+    end
+    local body, extra = s.rbuffer:readframe(spec)
+    if body then
+        return body, extra
+    elseif body == false then
+        return nil, extra
+    end
+    s.read_need = spec
+    game.co_attach(fd)
+    body, extra = game.co_yield()
+    game.co_detach(fd)
+    s.read_need = false
+    return body, extra
+end
+
+-- zero-copy reads for ffi parsers. ptr is a const uint8_t * into rbuffer,
+-- valid until the next read, peek, view or consume of fd: don't yield with it
+local function wait_view(fd, method, sz)
+    local s = assert(socket_pool[fd])
+    if s.errmsg then
+        return nil, s.errmsg
+    end
+    local ptr, len = s.rbuffer[method](s.rbuffer, sz)
+    if ptr then
+        return ffi_cast(u8ptr, ptr), len
+    end
+    s.read_need = sz
+    s.read_view = method
+    game.co_attach(fd)
+    ptr, len = game.co_yield()
+    game.co_detach(fd)
+    s.read_need = false
+    s.read_view = false
+    return ptr, len
+end
+
+-- ptr, sz once sz bytes are buffered, made contiguous if they span chains
+function _M.peek(fd, sz)
+    assert(sz > 0, "peek sz must > 0")
+    return wait_view(fd, "peek", sz)
+end
+
+-- ptr, len of the bytes buffered contiguously (at most sz), nothing is copied
+function _M.view(fd, sz)
+    assert(sz > 0, "view sz must > 0")
+    return wait_view(fd, "view", sz)
+end
+
+-- drop sz bytes that were parsed through peek/view
+function _M.consume(fd, sz)
+    local s = assert(socket_pool[fd])
+    return s.rbuffer:consume(sz)
+end
+
 local function concat_tab_buf(tab)
     local tmp = {}
     for _, v in ipairs(tab) do
@@ -317,22 +811,228 @@ function _M.write(fd, buf)
         return true
     end
     local s = assert(socket_pool[fd])
-    local ok = s.wbuffer:write(fd, buf)
-    if not ok then
-        s.writable = true
-        ae.enable(aefd, fd, true, true)
+    if s.rudp then
+        if s.errmsg then
+            return false
+        end
+        s.rudp:send(buf)
+        if not rudp_dirty[fd] then
+            rudp_dirty[fd] = s
+            rudp_ndirty = rudp_ndirty + 1
+        end
+        return true
+    end
+    local ok, wm
+    if cork_writes then
+        ok, wm = s.wbuffer:write(fd, buf, true)
+        if ok then
+            loop_stats.cork_writes = loop_stats.cork_writes + 1
+            -- a socket waiting for writable is flushed by its handler
+            if not s.writable and not cork_dirty[fd] then
+                cork_dirty[fd] = s
+                cork_ndirty = cork_ndirty + 1
+            end
+            ok = true
+        end
+    else
+        ok, wm = s.wbuffer:write(fd, buf)
+        if ok == false and wm ~= "overflow" and not s.writable then
+            s.writable = true
+            update_events(s)
+        end
+    end
+    if wm == "overflow" then
+        close(fd)
+        return nil, "write buffer overflow"
+    end
+    if wm == "high" then
+        local policy = s.wm_policy
+        if policy == "drop" then
+            loop_stats.backpressure_high = loop_stats.backpressure_high + 1
+            loop_stats.slow_drops = loop_stats.slow_drops + 1
+            close(fd)
+            return nil, "backpressure"
+        end
+        backpressure(s, wm)
+        local co = game.co_running()
+        if policy == "suspend" and co then
+            -- park the writer until the backlog drains to the low watermark
+            local waiters = s.write_waiters or {}
+            waiters[#waiters+1] = co
+            s.write_waiters = waiters
+            loop_stats.write_suspends = loop_stats.write_suspends + 1
+            return game.co_yield()
+        end
     end
     return ok
 end
 
-function _M.block_connect(ip, port)
-    local fd = anet.connect(ip, port)
-    local ok, err = ae.wait(fd, AE_WRITABLE)
-    if not ok then
-        close(fd)
+-- per connection write watermarks over the evloop.start defaults
+-- (write_high/write_low/on_backpressure). above high bytes queued:
+-- "suspend" parks the writing coroutine until the backlog drains to low,
+-- "drop" closes the connection, a function(fd, queued, "high"|"low") is
+-- called on both edges. high 0 turns it off
+function _M.watermark(fd, high, low, policy)
+    local s = assert(socket_pool[fd])
+    assert(s.wbuffer, "not a tcp connection")
+    s.wbuffer:watermark(high, low)
+    s.wm_policy = policy or "suspend"
+end
+
+-- moves what arrives on src to dst until src reaches eof. the bytes are
+-- spliced through a pipe and never enter lua, reads of src pause while dst
+-- is full. blocks the caller, returns the bytes forwarded or nil, err, bytes
+function _M.forward(src, dst)
+    local s, d = assert(socket_pool[src]), assert(socket_pool[dst])
+    assert(src ~= dst and s.rbuffer and d.wbuffer and not s.rudp and not d.rudp,
+        "forward needs two tcp connections")
+    assert(not s.fwd_out and not d.fwd_in, "already forwarding")
+    assert(not s.read_need, "src has a reader")
+    local co = assert(game.co_running(), "forward must run in a coroutine")
+    if s.errmsg then
+        return nil, s.errmsg, 0
+    end
+    -- what a reader already buffered goes first
+    local bytes = s.rbuffer:size()
+    if bytes > 0 then
+        local ok, err = _M.write(dst, s.rbuffer:readn(bytes))
+        if ok == nil then
+            return nil, err, 0
+        end
+        if socket_pool[src] ~= s or socket_pool[dst] ~= d then
+            return nil, "closed", bytes
+        end
+    end
+    local pump, err = anet.pump()
+    if not pump then
+        return nil, err, bytes
+    end
+    local f = { src = s, dst = d, pump = pump, co = co, state = "read", bytes = bytes }
+    s.fwd_out, d.fwd_in = f, f
+    forward_run(f)
+    if f.state ~= "done" then
+        f.waiting = true
+        game.co_yield()
+    end
+    if f.err then
+        return nil, f.err, f.bytes
+    end
+    return f.bytes
+end
+
+local function cork_flush_all()
+    local calls = 0
+    -- a writer resumed below may mark its socket dirty again
+    local dirty = cork_dirty
+    cork_dirty, cork_spare = cork_spare, dirty
+    cork_ndirty = 0
+    for fd, s in pairs(dirty) do
+        dirty[fd] = nil
+        local ok, n, wm = s.wbuffer:flush(fd, true, tcp_cork)
+        calls = calls + n
+        if not ok and not s.writable then
+            s.writable = true
+            update_events(s)
+        end
+        if wm then
+            backpressure(s, wm)
+        end
+        if ok and s.fwd_in then
+            forward_run(s.fwd_in)
+        end
+    end
+    loop_stats.cork_syscalls = loop_stats.cork_syscalls + calls
+end
+
+-- v4, [v6], v6 and unix:/path need no lookup
+local function is_literal(host)
+    return host:find(":", 1, true) or host:match("^%d+%.%d+%.%d+%.%d+$")
+end
+
+-- host -> ip, hostnames go through the resolver thread and a ttl cache
+local function resolve(host, timeout)
+    if is_literal(host) then
+        return host
+    end
+    local cached = dns_cache[host]
+    if cached and cached.expire > game.now() then
+        return cached.ip, cached.err
+    end
+    if not dns then
+        local err
+        dns, err = resolver.new()
+        if not dns then
+            return nil, err
+        end
+        local fd = dns:fd()
+        socket_pool[fd] = {
+            fd = fd,
+            ev_handler = event_handler.resolver,
+        }
+        ae.add_read(aefd, fd)
+    end
+    -- one lookup per host however many coroutines wait for it
+    local waiters = dns_pending[host]
+    if not waiters then
+        dns_next_id = dns_next_id + 1
+        local ok, err = dns:query(host, dns_next_id)
+        if not ok then
+            return nil, err
+        end
+        waiters = {}
+        dns_pending[host] = waiters
+        dns_queries[dns_next_id] = host
+    end
+    local co = game.co_running()
+    waiters[co] = true
+    local timer = game.add_timer_ms(timeout or CONNECT_TIMEOUT, function ()
+        if waiters[co] then
+            waiters[co] = nil
+            game.co_resume(co, nil, "timeout")
+        end
+    end)
+    game.co_attach(-1)
+    local ip, err = game.co_yield()
+    game.co_detach(-1)
+    game.del_timer(timer)
+    return ip, err
+end
+
+_M.resolve = resolve
+
+-- resolve and start a nonblocking connect, returns fd and the msec left
+local function open_connect(host, port, timeout, profile)
+    assert(game.co_running(), "connect must run in a coroutine, see game.fork")
+    local deadline = game.now() + timeout
+    local ip, err = resolve(host, timeout)
+    if not ip then
         return nil, err
     end
-    return fd
+    local fd
+    fd, err = raw_connect(ip, port, profile)
+    if fd < 0 then
+        return nil, err
+    end
+    local left = deadline - game.now()
+    return fd, left > 0 and left or 1
+end
+
+-- yields until the connecting fd turns writable, fails or the deadline passes
+local function connect_wait(fd, timeout)
+    local co = game.co_running()
+    local timer = game.add_timer_ms(timeout, function ()
+        game.co_resume(co, nil, "timeout")
+    end)
+    game.co_attach(fd)
+    local ok, err = game.co_yield()
+    game.co_detach(fd)
+    game.del_timer(timer)
+    return ok, err
+end
+
+-- kept for old scripts: the same as socket.connect without a pool
+function _M.block_connect(ip, port)
+    return _M.connect(ip, port)
 end
 
 local function create_pool(opts, host)
@@ -346,6 +1046,7 @@ local function create_pool(opts, host)
         backlog = opts.backlog or -1,
         pool_size = opts.pool_size or 30,
         pool_name = opts.pool or host,
+        profile = select(2, get_profile(opts.profile)),
     }
     local spool = setmetatable(default_pool, {
         __gc = function (tab)
@@ -379,18 +1080,20 @@ local function get_alive_peer(spool)
     end
 end
 
-local function simple_connect(ip, port)
+local function simple_connect(ip, port, timeout, profile)
     local running = game.co_running()
-    local fd = anet.connect(ip, port)
+    local fd, left = open_connect(ip, port, timeout, profile)
+    if not fd then
+        return nil, left
+    end
     ae.add_write(aefd, fd)
     socket_pool[fd] = {
         fd = fd,
         co = running,
         ev_handler = event_handler.connect,
     }
-    game.co_attach(fd)
-    local ok, err = game.co_yield()
-    game.co_detach(fd)
+    loop_stats.sockets = loop_stats.sockets + 1
+    local ok, err = connect_wait(fd, left)
     if not ok then
         close(fd)
         return nil, err
@@ -399,9 +1102,13 @@ local function simple_connect(ip, port)
     return fd
 end
 
-local function pool_connect(ip, port, spool)
+local function pool_connect(ip, port, spool, timeout)
     local running = game.co_running()
-    local fd = anet.connect(ip, port)
+    local fd, left = open_connect(ip, port, timeout, spool.profile)
+    if not fd then
+        spool.connections = spool.connections - 1
+        return nil, left
+    end
     ae.add_write(aefd, fd)
     local sock = {
         fd = fd,
@@ -410,10 +1117,9 @@ local function pool_connect(ip, port, spool)
         ev_handler = ev_connect_handler,
     }
     socket_pool[fd] = sock
-    game.co_attach(fd)
+    loop_stats.sockets = loop_stats.sockets + 1
     -- print("pool_connect begin yield", fd)
-    local ok, err = game.co_yield()
-    game.co_detach(fd)
+    local ok, err = connect_wait(fd, left)
     if not ok then
         spool.connections = spool.connections - 1
         close(fd)
@@ -427,12 +1133,17 @@ local function pool_connect(ip, port, spool)
     return fd
 end
 
+-- ip: v4/v6 address, hostname, or "unix:/path" with port nil for a co-located service.
+-- runs in a coroutine, the loop keeps serving others while it waits.
+-- opts.timeout: msec for the lookup and the connect (default 5000)
+-- opts.profile: as for listen, a pool keeps the profile it was created with
 function _M.connect(ip, port, opts)
+    local timeout = opts and opts.timeout or CONNECT_TIMEOUT
     if not opts or (not opts.pool_size and not opts.backlog) then
-        return simple_connect(ip, port)
+        return simple_connect(ip, port, timeout, select(2, get_profile(opts and opts.profile)))
     end
     local running = game.co_running()
-    local host = ip .. ":" .. port
+    local host = port and ip .. ":" .. port or ip
     local spool = connection_pool[opts.pool or host]
     if not spool then
         spool = create_pool(opts, host)
@@ -467,7 +1178,7 @@ function _M.connect(ip, port, opts)
             return fd, err
         end
     end
-    return pool_connect(ip, port, spool)
+    return pool_connect(ip, port, spool, timeout)
 end
 
 function _M.setkeepalive(fd)
@@ -496,8 +1207,414 @@ function _M.setkeepalive(fd)
     spool.free[s.fd] = nil
 end
 
+-- endpoint: "host:port" or "[v6]:port", port 0 picks an ephemeral port
+-- opts.batch: datagrams per recvmmsg/sendmmsg (default 64)
+-- opts.size: largest datagram (default 1500), opts.reuseport
+function _M.udp_bind(endpoint, opts)
+    opts = opts or {}
+    local host, port = parse_endpoint(endpoint)
+    if not host or not port then
+        return nil, "bad endpoint " .. endpoint
+    end
+    local u, err = udp.bind(host, port, opts.reuseport, opts.batch, opts.size)
+    if not u then
+        return nil, err
+    end
+    local fd = u:fd()
+    socket_pool[fd] = {
+        fd = fd,
+        udp = u,
+        msgs = new_tab((opts.batch or 64) * 2, 0),
+        ev_handler = event_handler.udp,
+    }
+    loop_stats.sockets = loop_stats.sockets + 1
+    ae.add_read(aefd, fd)
+    return fd
+end
+
+-- waits until datagrams arrive and returns n, msgs = {data1, addr1, ...}.
+-- msgs is reused by the next call, addr is opaque and goes back to udp_send
+function _M.udp_recv(fd)
+    local s = assert(socket_pool[fd])
+    while true do
+        local n, truncated = s.udp:recv(s.msgs)
+        if not n then
+            return nil, truncated
+        end
+        if truncated > 0 then
+            loop_stats.udp_truncated = loop_stats.udp_truncated + truncated
+        end
+        if n > 0 then
+            loop_stats.udp_rx = loop_stats.udp_rx + n
+            return n, s.msgs
+        end
+        s.co = game.co_running()
+        game.co_attach(fd)
+        game.co_yield()
+        game.co_detach(fd)
+        if socket_pool[fd] ~= s then
+            return nil, "closed"
+        end
+    end
+end
+
+local function udp_mark_dirty(fd, s)
+    if not udp_dirty[fd] then
+        udp_dirty[fd] = s
+        udp_ndirty = udp_ndirty + 1
+    end
+end
+
+-- queue a datagram, all queued datagrams go out before the loop blocks again
+function _M.udp_send(fd, addr, data)
+    local s = assert(socket_pool[fd])
+    local sent, dropped = s.udp:send(addr, data)
+    if sent > 0 or dropped > 0 then
+        loop_stats.udp_tx = loop_stats.udp_tx + sent
+        loop_stats.udp_drops = loop_stats.udp_drops + dropped
+    end
+    udp_mark_dirty(fd, s)
+end
+
+local function udp_flush_all()
+    for fd, s in pairs(udp_dirty) do
+        udp_dirty[fd] = nil
+        local sent, dropped = s.udp:flush()
+        loop_stats.udp_tx = loop_stats.udp_tx + sent
+        loop_stats.udp_drops = loop_stats.udp_drops + dropped
+    end
+    udp_ndirty = 0
+end
+
+-- udp_addr(host, port) -> addr for udp_send, udp_addr_info(addr) -> ip, port
+_M.udp_addr = udp.addr
+_M.udp_addr_info = udp.addr_info
+
+local rudp_free
+
+local function rudp_update(s, now)
+    s.rudp:update(now)
+    local state = s.rudp:state()
+    -- the fin isn't acked, repeat it every tick until the stream is freed
+    if s.closing and state >= 0 then
+        s.rudp:fin()
+    end
+    udp_mark_dirty(s.udp_fd, socket_pool[s.udp_fd])
+    if s.closing then
+        -- everything written before close was acked, or never will be
+        if state < 0 or s.rudp:waitsnd() == 0 then
+            rudp_free(s)
+        end
+        return
+    end
+    if state ~= 0 and rudp_conns[s.fd] then
+        -- the stream is over, the owner still has to close it
+        rudp_conns[s.fd] = nil
+        loop_stats.rudp_conns = loop_stats.rudp_conns - 1
+        on_read_error(s, state > 0 and "closed" or "timeout")
+    end
+end
+
+local function rudp_flush_all()
+    local now = game.now()
+    -- a coroutine resumed below may mark streams dirty again
+    local dirty = rudp_dirty
+    rudp_dirty, rudp_spare = rudp_spare, dirty
+    rudp_ndirty = 0
+    for fd, s in pairs(dirty) do
+        dirty[fd] = nil
+        if rudp_conns[fd] then
+            rudp_update(s, now)
+        end
+    end
+end
+
+-- retransmissions and window probes run on the timer wheel, one loop for all streams
+local function rudp_tick()
+    while next(rudp_conns) do
+        game.sleep_ms(rudp_interval)
+        local now = game.now()
+        -- resumed coroutines may open or close streams, don't walk rudp_conns itself
+        local n = 0
+        for _, s in pairs(rudp_conns) do
+            n = n + 1
+            rudp_round[n] = s
+        end
+        for i = 1, n do
+            local s = rudp_round[i]
+            rudp_round[i] = nil
+            if rudp_conns[s.fd] == s then
+                rudp_update(s, now)
+            end
+        end
+    end
+    rudp_ticking = false
+end
+
+local function rudp_input(s, data)
+    if not rudp_conns[s.fd] or not s.rudp:input(data, game.now()) then
+        return
+    end
+    local n, err = s.rudp:recv(s.rbuffer)
+    if s.closing then
+        -- only the acks matter to a closed stream
+        s.rbuffer:clear()
+    elseif not n then
+        return on_read_error(s, err)
+    elseif n > 0 and s.co then
+        wakeup_reader(s)
+    end
+    -- acks go out right before the loop blocks
+    if not rudp_dirty[s.fd] then
+        rudp_dirty[s.fd] = s
+        rudp_ndirty = rudp_ndirty + 1
+    end
+end
+
+-- the tick updates the stream and feeds it input until it is dropped again
+local function rudp_watch(s)
+    rudp_conns[s.fd] = s
+    loop_stats.rudp_conns = loop_stats.rudp_conns + 1
+    if not rudp_ticking then
+        rudp_ticking = true
+        game.fork(rudp_tick)
+    end
+end
+
+-- opts.interval: update tick msec, opts.minrto, opts.fastresend (0 disables it),
+-- opts.nodelay: back off rto by 1.5x, opts.sndwnd/rcvwnd: window in segments
+local function rudp_new(ufd, conv, addr, opts)
+    local u = socket_pool[ufd]
+    local c = rudp.new(conv, u.udp, addr)
+    c:config(opts.interval, opts.minrto, opts.fastresend, opts.nodelay)
+    c:wndsize(opts.sndwnd, opts.rcvwnd)
+    local id = rudp_next_id
+    rudp_next_id = rudp_next_id + 1
+    local s = {
+        fd = id,
+        rudp = c,
+        udp_fd = ufd,
+        addr = addr,
+        read_need = false,
+        read_view = false,
+        rbuffer = buffer.new(),
+        errmsg = nil,
+    }
+    socket_pool[id] = s
+    loop_stats.sockets = loop_stats.sockets + 1
+    if opts.interval and opts.interval < rudp_interval then
+        rudp_interval = opts.interval
+    end
+    rudp_watch(s)
+    return s
+end
+
+function rudp_free(s)
+    local fd = s.fd
+    if rudp_conns[fd] then
+        rudp_conns[fd] = nil
+        loop_stats.rudp_conns = loop_stats.rudp_conns - 1
+    end
+    if rudp_dirty[fd] then
+        rudp_dirty[fd] = nil
+        rudp_ndirty = rudp_ndirty - 1
+    end
+    if s.streams then
+        s.streams[s.key] = nil
+    end
+    s.rudp:close()
+    if s.own_udp then
+        close(s.udp_fd)
+    end
+end
+
+-- the stream lingers on the tick until the peer acked everything written
+-- before close or the link died, sending a best effort fin meanwhile
+function rudp_close(s)
+    loop_stats.sockets = loop_stats.sockets - 1
+    if s.rudp:state() < 0 then
+        return rudp_free(s)
+    end
+    -- a peer fin dropped the stream from the tick, its acks still matter
+    if not rudp_conns[s.fd] then
+        rudp_watch(s)
+    end
+    s.closing = true
+    rudp_update(s, game.now())
+end
+
+-- reliable ordered stream over udp, the returned ids work with read/readline/write/close.
+-- on_accept(id, ip, port) runs for the first segment of every new (address, conv),
+-- usually it calls socket.bind(id, logic) like for tcp
+function _M.rudp_listen(endpoint, on_accept, opts)
+    opts = opts or {}
+    local ufd, err = _M.udp_bind(endpoint, opts)
+    if not ufd then
+        return nil, err
+    end
+    local streams = {}
+    game.fork(function ()
+        while true do
+            local n, msgs = _M.udp_recv(ufd)
+            if not n then
+                break
+            end
+            for i = 1, n * 2, 2 do
+                local data, addr = msgs[i], msgs[i+1]
+                local conv, first = rudp.conv(data)
+                local key = addr .. conv
+                local s = streams[key]
+                if not s and first then
+                    s = rudp_new(ufd, conv, addr, opts)
+                    s.streams = streams
+                    s.key = key
+                    streams[key] = s
+                    on_accept(s.fd, udp.addr_info(addr))
+                end
+                if s then
+                    rudp_input(s, data)
+                end
+            end
+        end
+    end)
+    return ufd
+end
+
+-- no handshake: the stream is usable right away and the first write opens it
+-- on the listener, the running coroutine is bound as the reader
+function _M.rudp_connect(host, port, opts)
+    opts = opts or {}
+    local ip, err = _M.resolve(host, opts.timeout)
+    if not ip then
+        return nil, err
+    end
+    local addr
+    addr, err = udp.addr(ip:match("^%[(.+)%]$") or ip, port)
+    if not addr then
+        return nil, err
+    end
+    local ufd
+    ufd, err = _M.udp_bind(ip:find(":") and "[::]:0" or "0.0.0.0:0", opts)
+    if not ufd then
+        return nil, err
+    end
+    -- the listener tells streams apart by address and conv
+    if not rudp_seeded then
+        rudp_seeded = true
+        math.randomseed(os.time() + game.now())
+    end
+    local conv = math.random(1, 0x7fffffff)
+    local s = rudp_new(ufd, conv, addr, opts)
+    s.own_udp = true
+    s.co = game.co_running()
+    -- runs until rudp_free closes ufd, a closed stream still takes acks
+    local u = socket_pool[ufd]
+    game.fork(function ()
+        while socket_pool[ufd] == u do
+            local n, msgs = _M.udp_recv(ufd)
+            if not n then
+                break
+            end
+            for i = 1, n * 2, 2 do
+                rudp_input(s, msgs[i])
+            end
+        end
+    end)
+    return s.fd
+end
+
+-- out_segs, in_segs, retrans, fast_retrans, dup_segs, rto and waitsnd of one stream
+function _M.rudp_stats(fd)
+    local s = assert(socket_pool[fd])
+    return s.rudp:stats()
+end
+
+-- fired = {fd1, mask1, fd2, mask2, ...}, reused by every poll
+local fired = new_tab(AE_MAXEVENT * 2, 0)
+local update_cache_time = game.update_cache_time
+local stats_mark = cstats.mark
+
+-- one poll and its dispatch, true or nil, err if the poll itself failed
 function _M.event_wait(timeout)
-    ae.poll(aefd, timeout or -1, 64)
+    -- streams written to or acked since the last poll, their segments
+    -- join the udp queues flushed below
+    while rudp_ndirty > 0 do
+        rudp_flush_all()
+    end
+    -- datagrams queued by the last batch and by timers
+    if udp_ndirty > 0 then
+        udp_flush_all()
+    end
+    -- corked tcp writes of the last batch and of timers
+    while cork_ndirty > 0 do
+        cork_flush_all()
+    end
+    local n, err = ae.poll_batch(aefd, timeout or -1, max_events, fired, spin_us)
+    if not n then
+        return nil, err
+    end
+    update_cache_time()
+    for i = 1, n * 2, 2 do
+        local fd, mask = fired[i], fired[i+1]
+        -- an earlier handler of this batch may have closed the fd
+        if socket_pool[fd] then
+            local err
+            if band(mask, AE_ERR) ~= 0 then
+                err = ae.error(fd)
+            end
+            -- time each handler, the slowest fd shows up in stats
+            stats_mark(fd)
+            ev_base_handler(fd, band(mask, AE_READABLE) ~= 0, band(mask, AE_WRITABLE) ~= 0, err)
+        end
+    end
+    stats_mark(-1)
+    loop_stats.polls = loop_stats.polls + 1
+    loop_stats.events = loop_stats.events + n    return true
+end
+
+-- spin: usec to poll with timeout 0 before blocking, 0 disables it
+-- sock_busy_poll: SO_BUSY_POLL usec set on sockets accepted from now on
+function _M.set_busy_poll(spin, sock_busy_poll)
+    spin_us = spin or 0
+    busy_poll = sock_busy_poll
+end
+
+-- counters plus the poll/dispatch/handler histograms of gamenet.stats
+function _M.stats()
+    local st = cstats.snapshot()
+    st.thread = GAMENET_THREAD or 1
+    for k, v in pairs(loop_stats) do
+        st[k] = v
+    end
+    st.cork_saved = st.cork_writes - st.cork_syscalls
+    st.cork_saved_per_poll = st.polls > 0 and st.cork_saved / st.polls or 0
+    -- queued bytes gauges, summed on demand to keep writes cheap
+    local wbytes, rbytes, wmax, wmax_fd, suspended, forwards = 0, 0, 0, -1, 0, 0
+    for fd, s in pairs(socket_pool) do
+        if s.wbuffer then
+            local n = s.wbuffer:size()
+            wbytes = wbytes + n
+            if n > wmax then
+                wmax, wmax_fd = n, fd
+            end
+        end
+        if s.rbuffer then
+            rbytes = rbytes + s.rbuffer:size()
+        end
+        if s.write_waiters then
+            suspended = suspended + #s.write_waiters
+        end
+        if s.fwd_out then
+            forwards = forwards + 1
+        end
+    end
+    st.wbuffer_bytes = wbytes
+    st.wbuffer_max = wmax
+    st.wbuffer_max_fd = wmax_fd
+    st.rbuffer_bytes = rbytes
+    st.writers_suspended = suspended
+    st.forwards = forwards
+    return st
 end
 
 function _M.onclose(fd, callback)
@@ -29,9 +29,17 @@ local function client_loop(fd)
     end
 end
 
-evloop.start("0.0.0.0:" .. config.chatserver_ports, function (fd, ip, port)
+local function on_accept(fd, ip, port)
     print("accept a connection:", fd, ip, port)
     socket.bind(fd, client_loop)
-end)
+end
+
+-- CHATSERVER_PORT picks one of the configured ports when there are several
+local ports = config.chatserver_ports
+local port = tonumber(os.getenv("CHATSERVER_PORT")) or (type(ports) == "table" and ports[1] or ports)
+evloop.start("0.0.0.0:" .. port, on_accept)
+if config.chatserver_unix then
+    socket.listen("unix:" .. config.chatserver_unix .. "." .. port, on_accept)
+end
 
 evloop.run()
@@ -4,6 +4,7 @@ package.path = package.path .. ";./lualib/?.lua;"
 
 local socket = require "socket"
 local evloop = require "evloop"
+local game = require "game"
 
 evloop.start()
 
@@ -20,12 +21,17 @@ local function upstream_loop(upfd)
     end
 end
 
-local clientfd, err = socket.block_connect("127.0.0.1", 8989)
-if clientfd ~= -1 then
-    socket.bind(clientfd, upstream_loop)
-else
-    print("block_connect 127.0.0.1:8989 error:", err)
-end
+local clientfd
+game.fork(function ()
+    local err
+    clientfd, err = socket.connect("127.0.0.1", 8989)
+    if clientfd then
+        socket.bind(clientfd, upstream_loop)
+    else
+        print("connect 127.0.0.1:8989 error:", err)
+        evloop.stop()
+    end
+end)
 
 local function console_loop(fd)
     while true do
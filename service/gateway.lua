@@ -3,22 +3,57 @@ package.path = package.path .. ";./lualib/?.lua;"
 
 local socket = require "socket"
 local evloop = require "evloop"
+local game = require "game"
 local config = require "configure"
 
 local clients = {}
 local chatservers = {}
 local current_server = 1
 
-local function connect_chatservers()
-    for _, port in ipairs(config.chatserver_ports) do
-        local serverfd, err = socket.block_connect("127.0.0.1", port)
-        if serverfd ~= -1 then
-            table.insert(chatservers, serverfd)
-            socket.bind(serverfd, server_loop)
+local server_loop
+
+local function connect_chatserver(host, port)
+    -- an unreachable chatserver only delays itself, clients keep being served
+    local serverfd, err = socket.connect(host, port, { timeout = 3000 })
+    if serverfd then
+        table.insert(chatservers, serverfd)
+        socket.bind(serverfd, server_loop)
+    else
+        print("connect " .. host .. ":" .. tostring(port) .. " error:", err)
+    end
+end
+
+-- {host, port} of every chatserver, over unix one per port and loop thread
+local function chatserver_endpoints()
+    local ports = config.chatserver_ports
+    local endpoints = {}
+    for _, port in ipairs(type(ports) == "table" and ports or {ports}) do
+        if config.chatserver_unix then
+            -- same host: skip the loopback tcp stack
+            local path = "unix:" .. config.chatserver_unix .. "." .. port
+            local nthread = config.chatserver_threads or 1
+            if nthread > 1 then
+                for i = 1, nthread do
+                    table.insert(endpoints, { path .. "." .. i })
+                end
+            else
+                table.insert(endpoints, { path })
+            end
         else
-            print("block_connect 127.0.0.1:" .. port .. " error:", err)
+            table.insert(endpoints, { "127.0.0.1", port })
         end
     end
+    return endpoints
+end
+
+local endpoints = chatserver_endpoints()
+
+local function connect_chatservers()
+    for _, ep in ipairs(endpoints) do
+        game.fork(function ()
+            connect_chatserver(ep[1], ep[2])
+        end)
+    end
 end
 
 local function client_loop(fd)
@@ -37,7 +72,7 @@ local function client_loop(fd)
     end
 end
 
-local function server_loop(fd)
+function server_loop(fd)
     while true do
         local buf, err = socket.readline(fd, "\n")
         if err then
@@ -53,11 +88,36 @@ local function server_loop(fd)
     end
 end
 
+-- opaque proxy: a chatserver connection per client, spliced both ways
+local function proxy_loop(fd)
+    local ep = endpoints[current_server]
+    current_server = (current_server % #endpoints) + 1
+    local serverfd, err = socket.connect(ep[1], ep[2], { timeout = 3000 })
+    if not serverfd then
+        print("connect chatserver error:", err)
+        socket.close(fd)
+        return
+    end
+    socket.bind(serverfd, function (serverfd)
+        socket.forward(serverfd, fd)
+        socket.close(fd)
+        socket.close(serverfd)
+    end)
+    socket.forward(fd, serverfd)
+    socket.close(fd)
+    socket.close(serverfd)
+end
+
 evloop.start("0.0.0.0:" .. config.gateway_port, function (fd, ip, port)
     print("accept a connection:", fd, ip, port)
+    if config.gateway_proxy then
+        return socket.bind(fd, proxy_loop)
+    end
     clients[fd] = true
     socket.bind(fd, client_loop)
 end)
 
-connect_chatservers()
+if not config.gateway_proxy then
+    game.fork(connect_chatservers)
+end
 evloop.run()
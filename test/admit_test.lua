@@ -0,0 +1,51 @@
+-- 准入控制测试：双栈监听下v4客户端以::ffff:a.b.c.d出现，按v4地址限流，不和v6主机共用桶
+-- ./gamenet test/admit_test.lua
+package.cpath = package.cpath..";./luaclib/?.so;"
+package.path = package.path .. ";./lualib/?.lua;"
+
+local evloop = require "evloop"
+local socket = require "socket"
+local game = require "game"
+
+local PORT = 9200
+
+local failed = 0
+local function check(name, ok)
+    print(("%-40s %s"):format(name, ok and "ok" or "FAIL"))
+    if not ok then
+        failed = failed + 1
+    end
+end
+
+-- two connections per source, practically no refill
+local accepted = {}
+evloop.start("[::]:" .. PORT, function (fd, ip)
+    accepted[#accepted+1] = ip
+    socket.close(fd)
+end, { admission = { ip_rate = 0.001, ip_burst = 2 } })
+
+local function count(ip)
+    local n = 0
+    for _, v in ipairs(accepted) do
+        if v == ip then
+            n = n + 1
+        end
+    end
+    return n
+end
+
+game.fork(function ()
+    -- one at a time so the accept order is the connect order
+    for _, ip in ipairs({"127.0.0.1", "127.0.0.1", "127.0.0.1", "::1"}) do
+        local fd = assert(socket.connect(ip, PORT))
+        game.sleep_ms(20)
+        socket.close(fd)
+    end
+    check("v4-mapped source limited to its burst", count("::ffff:127.0.0.1") == 2)
+    check("v6 host keeps its own bucket", count("::1") == 1)
+    check("one rejection counted", evloop.stats().rejected_ip == 1)
+    print(failed == 0 and "all passed" or (failed .. " failed"))
+    os.exit(failed == 0 and 0 or 1)
+end)
+
+evloop.run()
@@ -0,0 +1,68 @@
+// 建连压测：nproc个进程各自循环 connect、发一行、收回显、close，统计每秒连接数(cps)
+// gcc -O2 test/cps_bench.c -o cps_bench
+// ./cps_bench 127.0.0.1 8989 10000 [nproc=4]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static double
+now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns the number of failed connections
+static int
+run(struct sockaddr_in *addr, int n) {
+    int failed = 0;
+    char buf[16];
+    for (int i = 0; i < n; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+            write(fd, "ping\n", 5) != 5 || read(fd, buf, sizeof(buf)) <= 0) {
+            failed++;
+        }
+        close(fd);
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s ip port [total=10000] [nproc=4]\n", argv[0]);
+        return 1;
+    }
+    int total = argc > 3 ? atoi(argv[3]) : 10000;
+    int nproc = argc > 4 ? atoi(argv[4]) : 4;
+    if (nproc < 1) nproc = 1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    inet_pton(AF_INET, argv[1], &addr.sin_addr);
+
+    double start = now_sec();
+    for (int p = 0; p < nproc; p++) {
+        if (fork() == 0) {
+            int n = total / nproc + (p < total % nproc);
+            exit(run(&addr, n) > 0);
+        }
+    }
+    int failed = 0, status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    double cost = now_sec() - start;
+    printf("connections %d procs %d cost %.3fs cps %.0f%s\n", total, nproc, cost, total / cost,
+        failed ? " (some connections failed)" : "");
+    return 0;
+}
@@ -0,0 +1,135 @@
+// echo服务压测：nconn个连接并发ping-pong，共发送total条消息后统计耗时
+// gcc -O2 test/echo_bench.c -o echo_bench
+// ./echo_bench 127.0.0.1 8989 100 10000 64 [delay]
+// ip写成unix:/path时走unix socket(port忽略)，用来对比同机tcp回环的延迟
+// 统计服务端系统调用次数：连接建立后等待delay秒再发送，期间执行 strace -c -f -p $(pidof gamenet)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct {
+    int fd;
+    int got;        // bytes of the current echo already received
+} conn_t;
+
+static double
+now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s ip port [nconn=100] [total=10000] [msgsize=64] [delay=0]\n", argv[0]);
+        return 1;
+    }
+    const char *ip = argv[1];
+    int port = atoi(argv[2]);
+    int nconn = argc > 3 ? atoi(argv[3]) : 100;
+    int total = argc > 4 ? atoi(argv[4]) : 10000;
+    int msgsize = argc > 5 ? atoi(argv[5]) : 64;
+    int delay = argc > 6 ? atoi(argv[6]) : 0;
+    if (msgsize < 2) msgsize = 2;
+
+    char *msg = malloc(msgsize);
+    memset(msg, 'x', msgsize - 1);
+    msg[msgsize - 1] = '\n';
+    char *rbuf = malloc(msgsize);
+
+    int ep = epoll_create(1);
+    conn_t *conns = calloc(nconn, sizeof(conn_t));
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    memset(&addr, 0, sizeof(addr));
+    if (strncmp(ip, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, ip + 5, sizeof(un->sun_path) - 1);
+        addrlen = sizeof(*un);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        inet_pton(AF_INET, ip, &in->sin_addr);
+        addrlen = sizeof(*in);
+    }
+    for (int i = 0; i < nconn; i++) {
+        int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&addr, addrlen) < 0) {
+            perror("connect");
+            return 1;
+        }
+        int one = 1;
+        if (addr.ss_family == AF_INET)
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        conns[i].fd = fd;
+        struct epoll_event e;
+        e.events = EPOLLIN;
+        e.data.ptr = &conns[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e);
+    }
+
+    if (delay > 0) {
+        printf("%d connections ready, start in %ds\n", nconn, delay);
+        fflush(stdout);
+        sleep(delay);
+    }
+
+    int sent = 0, done = 0;
+    double start = now_sec();
+    for (int i = 0; i < nconn && sent < total; i++, sent++) {
+        if (write(conns[i].fd, msg, msgsize) != msgsize) {
+            perror("write");
+            return 1;
+        }
+    }
+    struct epoll_event events[256];
+    while (done < total) {
+        int n = epoll_wait(ep, events, 256, 5000);
+        if (n <= 0) {
+            fprintf(stderr, "timeout, %d/%d echoed\n", done, total);
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            conn_t *c = events[i].data.ptr;
+            int r = read(c->fd, rbuf, msgsize - c->got);
+            if (r <= 0) {
+                if (r < 0 && errno == EAGAIN)
+                    continue;
+                fprintf(stderr, "server closed\n");
+                return 1;
+            }
+            c->got += r;
+            if (c->got < msgsize)
+                continue;
+            c->got = 0;
+            done++;
+            if (sent < total) {
+                sent++;
+                if (write(c->fd, msg, msgsize) != msgsize) {
+                    perror("write");
+                    return 1;
+                }
+            }
+        }
+    }
+    double cost = now_sec() - start;
+    // every connection has one message in flight, so this is the mean round trip
+    printf("conns %d messages %d size %d cost %.3fs qps %.0f rtt %.1fus\n",
+        nconn, total, msgsize, cost, total / cost, cost * nconn / total * 1e6);
+    for (int i = 0; i < nconn; i++)
+        close(conns[i].fd);
+    return 0;
+}
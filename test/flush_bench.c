@@ -0,0 +1,115 @@
+// 写缓冲区flush压测：排队nmsg条小消息后整体flush到socketpair(子进程读走丢弃)，
+// 对比旧的buffer_write_atmost拼成一块再write和按链writev，统计耗时和系统调用数
+// gcc -O2 -I core test/flush_bench.c core/buffer.c core/anet.c -o flush_bench
+// ./flush_bench [nmsg=10000] [size=32] [rounds=200]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "buffer.h"
+#include "anet.h"
+
+#define IOV_MAX_FLUSH 64
+
+static double
+now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+wait_writable(int fd) {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    poll(&pfd, 1, -1);
+}
+
+// the old lflush: linearize everything, then one write
+static long
+flush_linear(buffer_t *p, int fd) {
+    long calls = 0;
+    while (p->total_len > 0) {
+        uint8_t *buf = buffer_write_atmost(p);
+        int n = anet_tcp_write(fd, buf, p->total_len);
+        calls++;
+        if (n == -2) {
+            wait_writable(fd);
+            continue;
+        }
+        if (n < 0)
+            exit(1);
+        buffer_drain(p, n);
+    }
+    return calls;
+}
+
+static long
+flush_writev(buffer_t *p, int fd) {
+    struct iovec iov[IOV_MAX_FLUSH];
+    long calls = 0;
+    while (p->total_len > 0) {
+        uint32_t bytes;
+        int cnt = buffer_peek_iov(p, iov, IOV_MAX_FLUSH, &bytes);
+        int n = anet_tcp_writev(fd, iov, cnt);
+        calls++;
+        if (n == -2) {
+            wait_writable(fd);
+            continue;
+        }
+        if (n < 0)
+            exit(1);
+        buffer_drain(p, n);
+    }
+    return calls;
+}
+
+static void
+bench(const char *name, long (*flush)(buffer_t *, int), int fd, int nmsg, int size, int rounds) {
+    char msg[size];
+    memset(msg, 'x', size);
+    buffer_t p;
+    memset(&p, 0, sizeof(p));
+    p.last_with_datap = &p.first;
+    long calls = 0;
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < nmsg; i++)
+            buffer_add(&p, msg, size);
+        calls += flush(&p, fd);
+    }
+    double cost = now_sec() - start;
+    double mb = (double)nmsg * size * rounds / 1048576;
+    printf("%-8s msgs %d x %dB rounds %d cost %.3fs %.0f MB/s syscalls %ld\n",
+        name, nmsg, size, rounds, cost, mb / cost, calls);
+}
+
+int main(int argc, char *argv[]) {
+    int nmsg = argc > 1 ? atoi(argv[1]) : 10000;
+    int size = argc > 2 ? atoi(argv[2]) : 32;
+    int rounds = argc > 3 ? atoi(argv[3]) : 200;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sv[0]);
+        char buf[65536];
+        while (read(sv[1], buf, sizeof(buf)) > 0)
+            ;
+        exit(0);
+    }
+    close(sv[1]);
+    _anet_tcp_set_nonblock(sv[0]);
+    bench("linear", flush_linear, sv[0], nmsg, size, rounds);
+    bench("writev", flush_writev, sv[0], nmsg, size, rounds);
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
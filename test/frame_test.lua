@@ -0,0 +1,58 @@
+-- 分帧测试：各种帧头格式经管道写进接收缓冲区，检查readframe的结果和出错情况
+-- ./gamenet test/frame_test.lua
+package.cpath = package.cpath..";./luaclib/?.so;"
+package.path = package.path .. ";./lualib/?.lua;"
+
+local buffer = require "gamenet.buffer"
+local ffi = require "ffi"
+
+ffi.cdef[[
+int pipe(int fds[2]);
+long write(int fd, const void *buf, size_t n);
+int close(int fd);
+]]
+
+local fds = ffi.new("int[2]")
+assert(ffi.C.pipe(fds) == 0)
+
+-- a fresh buffer holding data, read through the pipe like a socket
+local function buffered(data)
+    local b = buffer.new()
+    assert(ffi.C.write(fds[1], data, #data) == #data)
+    assert(b:read(fds[0], #data) == #data)
+    return b
+end
+
+local failed = 0
+local function check(name, frame, data, want, want_extra)
+    local body, extra = buffered(data):readframe(buffer.framespec(frame))
+    local ok
+    if want == false then
+        ok = body == false and extra == want_extra
+    else
+        ok = body == want and (want_extra == nil or extra == want_extra)
+    end
+    print(("%-32s %s"):format(name, ok and "ok" or ("FAIL got " .. tostring(body) .. ", " .. tostring(extra))))
+    if not ok then
+        failed = failed + 1
+    end
+end
+
+check("2 byte big endian", { len = 2 }, "\0\5hello", "hello")
+check("2 byte partial", { len = 2 }, "\0\5hel", nil)
+check("3 byte little endian + extra", { len = 3, endian = "le", extra = 1 }, "\5\0\0\7hello", "hello", 7)
+check("4 byte length includes header", { len = 4, include = true }, "\0\0\0\9hello", "hello")
+check("length shorter than header", { len = 4, include = true }, "\0\0\0\1", false, "frame length shorter than its header")
+check("too big", { len = 4, max = 4 }, "\0\0\0\5hello", false, "frame too big")
+check("varint 1 byte", { len = "varint" }, "\5hello", "hello")
+check("varint 2 bytes", { len = "varint" }, "\133\0hello", "hello")
+check("varint 2 bytes whole", { len = "varint" }, "\5\0hello", "\0hell")
+check("varint 5 bytes max", { len = "varint", max = 0xffffffff }, "\255\255\255\255\015", nil)
+-- 2^32 used to wrap to 0 and came back as an empty frame
+check("varint 2^32", { len = "varint", max = 0xffffffff }, "\128\128\128\128\016", false, "bad varint frame length")
+check("varint 6 bytes", { len = "varint" }, "\128\128\128\128\128\001", false, "bad varint frame length")
+
+ffi.C.close(fds[0])
+ffi.C.close(fds[1])
+print(failed == 0 and "all passed" or (failed .. " failed"))
+os.exit(failed == 0 and 0 or 1)
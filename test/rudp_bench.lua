@@ -0,0 +1,86 @@
+-- 可靠udp回显：同进程内服务端+客户端，可选中间代理按比例丢包，统计往返延迟和重传
+-- N=2000 LOSS=0.1 ./gamenet test/rudp_bench.lua
+package.cpath = package.cpath..";./luaclib/?.so;"
+package.path = package.path .. ";./lualib/?.lua;"
+io.stdout:setvbuf("no")
+
+local socket = require "socket"
+local evloop = require "evloop"
+local game = require "game"
+local core = require "gamenet.core"
+
+local N = tonumber(os.getenv("N")) or 2000
+local LOSS = tonumber(os.getenv("LOSS")) or 0
+local SERVER_PORT = 9100
+local PROXY_PORT = 9101
+local opts = { interval = 10, nodelay = true, minrto = 30 }
+
+evloop.start()
+
+assert(socket.rudp_listen("127.0.0.1:" .. SERVER_PORT, function (id)
+    socket.bind(id, function ()
+        while true do
+            local line = socket.readline(id)
+            if not line then
+                break
+            end
+            socket.write(id, line .. "\n")
+        end
+        socket.close(id)
+    end)
+end, opts))
+
+-- drops LOSS of the datagrams in both directions
+local port = SERVER_PORT
+if LOSS > 0 then
+    port = PROXY_PORT
+    local front = assert(socket.udp_bind("127.0.0.1:" .. PROXY_PORT))
+    local back = assert(socket.udp_bind("127.0.0.1:0"))
+    local server = socket.udp_addr("127.0.0.1", SERVER_PORT)
+    local client
+    game.fork(function ()
+        while true do
+            local n, msgs = socket.udp_recv(front)
+            for i = 1, n * 2, 2 do
+                client = msgs[i+1]
+                if math.random() >= LOSS then
+                    socket.udp_send(back, server, msgs[i])
+                end
+            end
+        end
+    end)
+    game.fork(function ()
+        while true do
+            local n, msgs = socket.udp_recv(back)
+            for i = 1, n * 2, 2 do
+                if client and math.random() >= LOSS then
+                    socket.udp_send(front, client, msgs[i])
+                end
+            end
+        end
+    end)
+end
+
+game.fork(function ()
+    local fd = assert(socket.rudp_connect("127.0.0.1", port, opts))
+    local rtt = {}
+    local start = core.mono_ms()
+    for i = 1, N do
+        local t = core.mono_ms()
+        socket.write(fd, "ping " .. i .. "\n")
+        local line = assert(socket.readline(fd))
+        assert(line == "ping " .. i, line)
+        rtt[i] = core.mono_ms() - t
+    end
+    local cost = core.mono_ms() - start
+    table.sort(rtt)
+    local st = socket.rudp_stats(fd)
+    print(("loss %.2f msgs %d cost %dms rtt p50 %dms p99 %dms max %dms"):format(
+        LOSS, N, cost, rtt[math.ceil(N * 0.5)], rtt[math.ceil(N * 0.99)], rtt[N]))
+    print(("out_segs %d retrans %d fast_retrans %d dup_segs %d rto %d"):format(
+        st.out_segs, st.retrans, st.fast_retrans, st.dup_segs, st.rto))
+    socket.close(fd)
+    evloop.stop()
+end)
+
+evloop.run()
@@ -0,0 +1,225 @@
+// 分隔符查找压测：对比旧的逐字节check_sep和memchr跳到候选首字节的buffer_search，
+// 场景包括跨多个链的长行、跨链的分隔符、逐段到达时的续查，以及RESP风格的短行
+// gcc -O2 -I core test/search_bench.c core/buffer.c -o search_bench
+// ./search_bench [linelen=65536] [rounds=2000]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "buffer.h"
+
+static double
+now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+buffer_init(buffer_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->last_with_datap = &p->first;
+}
+
+static void
+buffer_reset(buffer_t *p) {
+    buffer_drain(p, p->total_len);
+    buffer_init(p);
+}
+
+// the previous buffer_search, one check_sep per byte
+static bool
+old_check_sep(buf_chain_t *chain, int from, const char *sep, int seplen) {
+    for (;;) {
+        int sz = chain->off - from;
+        if (sz >= seplen)
+            return memcmp(chain->buffer + chain->misalign + from, sep, seplen) == 0;
+        if (sz > 0 && memcmp(chain->buffer + chain->misalign + from, sep, sz))
+            return false;
+        chain = chain->next;
+        sep += sz;
+        seplen -= sz;
+        from = 0;
+    }
+}
+
+static int
+old_search(buffer_t *buf, const char *sep, const int seplen) {
+    buf_chain_t *chain = buf->first;
+    int i;
+    if (chain == NULL || buf->total_len < (uint32_t)seplen)
+        return 0;
+    int bytes = chain->off;
+    while (bytes <= buf->last_read_pos) {
+        chain = chain->next;
+        if (chain == NULL)
+            return 0;
+        bytes += chain->off;
+    }
+    bytes -= buf->last_read_pos;
+    int from = chain->off - bytes;
+    for (i = buf->last_read_pos; i <= (int)(buf->total_len - seplen); i++) {
+        if (old_check_sep(chain, from, sep, seplen)) {
+            buf->last_read_pos = 0;
+            return i + seplen;
+        }
+        ++from;
+        --bytes;
+        if (bytes == 0) {
+            chain = chain->next;
+            from = 0;
+            if (chain == NULL)
+                break;
+            bytes = chain->off;
+        }
+    }
+    buf->last_read_pos = i;
+    return 0;
+}
+
+typedef int (*search_fn)(buffer_t *, const char *, const int);
+
+static int
+chains(buffer_t *p) {
+    int n = 0;
+    for (buf_chain_t *c = p->first; c; c = c->next)
+        n += c->off > 0;
+    return n;
+}
+
+// the same random line fed in random pieces must give the same answers
+static void
+verify(int iters) {
+    buffer_t a, b;
+    buffer_init(&a);
+    buffer_init(&b);
+    char data[9000];
+    const char *seps[] = {"\n", "\r\n", "\r\n\r\n", "abc"};
+    srand(7);
+    for (int it = 0; it < iters; it++) {
+        const char *sep = seps[it % 4];
+        int seplen = strlen(sep);
+        int len = 1 + rand() % sizeof(data);
+        for (int i = 0; i < len; i++)
+            data[i] = "abc\r\nx"[rand() % 6];
+        int off = 0;
+        while (off < len) {
+            int n = 1 + rand() % 1500;
+            if (n > len - off)
+                n = len - off;
+            buffer_add(&a, data + off, n);
+            buffer_add(&b, data + off, n);
+            off += n;
+            for (;;) {
+                int x = old_search(&a, sep, seplen);
+                int y = buffer_search(&b, sep, seplen);
+                if (x != y) {
+                    printf("mismatch iter %d: old %d new %d\n", it, x, y);
+                    exit(1);
+                }
+                if (x == 0)
+                    break;
+                buffer_drain(&a, x);
+                buffer_drain(&b, x);
+            }
+        }
+        buffer_reset(&a);
+        buffer_reset(&b);
+    }
+    printf("verify   %d random streams ok\n", iters);
+}
+
+// one long line arriving in mss sized pieces, searched after each piece
+static void
+bench_long(const char *name, search_fn search, int linelen, int rounds) {
+    char *line = malloc(linelen + 2);
+    memset(line, 'x', linelen);
+    memcpy(line + linelen, "\r\n", 2);
+    buffer_t p;
+    buffer_init(&p);
+    int nchain = 0;
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        int off = 0, n = 0;
+        while (off < linelen + 2) {
+            int sz = linelen + 2 - off < 1448 ? linelen + 2 - off : 1448;
+            buffer_add(&p, line + off, sz);
+            off += sz;
+            n = search(&p, "\r\n", 2);
+        }
+        if (n != linelen + 2) {
+            printf("%s: bad result %d\n", name, n);
+            exit(1);
+        }
+        nchain = chains(&p);
+        buffer_drain(&p, n);
+    }
+    double cost = now_sec() - start;
+    printf("%-8s long line %dB in %d chains, rounds %d cost %.3fs %.0f MB/s\n",
+        name, linelen, nchain, rounds, cost, (double)linelen * rounds / 1048576 / cost);
+    buffer_reset(&p);
+    free(line);
+}
+
+// a whole long line already buffered, searched once (readline after a big read)
+static void
+bench_once(const char *name, search_fn search, int linelen, int rounds) {
+    char *line = malloc(linelen + 2);
+    memset(line, 'x', linelen);
+    memcpy(line + linelen, "\r\n", 2);
+    buffer_t p;
+    buffer_init(&p);
+    for (int off = 0; off < linelen + 2; off += 4096)
+        buffer_add(&p, line + off, linelen + 2 - off < 4096 ? linelen + 2 - off : 4096);
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        p.last_read_pos = 0;
+        if (search(&p, "\r\n", 2) != linelen + 2) {
+            printf("%s: bad result\n", name);
+            exit(1);
+        }
+    }
+    double cost = now_sec() - start;
+    printf("%-8s buffered line %dB in %d chains, rounds %d cost %.3fs %.0f MB/s\n",
+        name, linelen, chains(&p), rounds, cost, (double)linelen * rounds / 1048576 / cost);
+    buffer_reset(&p);
+    free(line);
+}
+
+// RESP style replies, many short \r\n lines per read
+static void
+bench_resp(const char *name, search_fn search, int rounds) {
+    char chunk[16384];
+    int len = 0;
+    while (len + 32 < (int)sizeof(chunk))
+        len += sprintf(chunk + len, "$11\r\nhello world\r\n");
+    buffer_t p;
+    buffer_init(&p);
+    long lines = 0;
+    double start = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        buffer_add(&p, chunk, len);
+        int n;
+        while ((n = search(&p, "\r\n", 2)) > 0) {
+            buffer_drain(&p, n);
+            lines++;
+        }
+    }
+    double cost = now_sec() - start;
+    printf("%-8s resp lines %ld cost %.3fs %.1f Mlines/s\n", name, lines, cost, lines / cost / 1e6);
+    buffer_reset(&p);
+}
+
+int main(int argc, char *argv[]) {
+    int linelen = argc > 1 ? atoi(argv[1]) : 65536;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    verify(20000);
+    bench_long("old", old_search, linelen, rounds / 10);
+    bench_long("memchr", buffer_search, linelen, rounds / 10);
+    bench_once("old", old_search, linelen, rounds);
+    bench_once("memchr", buffer_search, linelen, rounds);
+    bench_resp("old", old_search, rounds);
+    bench_resp("memchr", buffer_search, rounds);
+    return 0;
+}
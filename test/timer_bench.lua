@@ -0,0 +1,69 @@
+-- 定时器压测：100万个待触发定时器的添加、取消和批量过期
+-- ./gamenet test/timer_bench.lua [ntimer]
+package.cpath = package.cpath..";./luaclib/?.so;"
+package.path = package.path .. ";./lualib/?.lua;"
+
+local timer = require "gamenet.timer"
+local game = require "game"
+
+local N = tonumber(arg and arg[1]) or 1000000
+local clock = os.clock
+
+local function bench(name, f)
+    collectgarbage()
+    local t = clock()
+    local n = f()
+    local cost = clock() - t
+    print(("%-28s %8d ops %8.3fs %10.0f ops/s"):format(name, n, cost, n / cost))
+end
+
+math.randomseed(1)
+local delays = {}
+for i = 1, N do
+    delays[i] = math.random(1, 360000) -- up to one hour in csec
+end
+
+local now = 0
+local w = timer.new(now)
+local ids = {}
+bench("wheel add", function ()
+    for i = 1, N do
+        ids[i] = w:add(delays[i])
+    end
+    return N
+end)
+print("pending", w:count())
+
+bench("wheel cancel half", function ()
+    for i = 1, N, 2 do
+        w:cancel(ids[i])
+    end
+    return N / 2
+end)
+
+local out = {}
+bench("wheel expire all", function ()
+    local total = 0
+    while w:count() > 0 do
+        now = now + w:next()
+        total = total + w:expire(now, out)
+    end
+    return total
+end)
+
+-- game.add_timer keeps a coroutine per timer, measure a smaller set
+local M = math.min(N, 100000)
+game.init_timer()
+local tids = {}
+bench("game.add_timer", function ()
+    for i = 1, M do
+        tids[i] = game.add_timer(delays[i], function () end)
+    end
+    return M
+end)
+bench("game.del_timer", function ()
+    for i = 1, M do
+        game.del_timer(tids[i])
+    end
+    return M
+end)
@@ -0,0 +1,55 @@
+-- 定时器测试：同一批到期的定时器在回调里互相取消、取消后不再触发、sleep_ms的精度
+-- ./gamenet test/timer_test.lua
+package.cpath = package.cpath..";./luaclib/?.so;"
+package.path = package.path .. ";./lualib/?.lua;"
+
+local evloop = require "evloop"
+local game = require "game"
+local core = require "gamenet.core"
+
+local failed = 0
+local function check(name, ok)
+    print(("%-40s %s"):format(name, ok and "ok" or "FAIL"))
+    if not ok then
+        failed = failed + 1
+    end
+end
+
+evloop.start()
+
+-- a and b expire in the same tick, whichever runs first cancels the other
+local ran = {}
+local a, b
+a = game.add_timer_ms(10, function ()
+    ran[#ran+1] = "a"
+    game.del_timer(b)
+end)
+b = game.add_timer_ms(10, function ()
+    ran[#ran+1] = "b"
+    game.del_timer(a)
+end)
+
+-- cancelled well before it expires
+local late = false
+local c = game.add_timer_ms(20, function () late = true end)
+game.del_timer(c)
+
+-- cancelling a timer that already ran is a no-op
+local d_runs = 0
+local d
+d = game.add_timer_ms(5, function () d_runs = d_runs + 1 end)
+
+game.fork(function ()
+    local t = core.mono_ms()
+    game.sleep_ms(50)
+    local slept = core.mono_ms() - t
+    game.del_timer(d)
+    check("sibling cancelled in the same batch", #ran == 1)
+    check("cancelled timer never fires", not late)
+    check("cancel after firing is harmless", d_runs == 1)
+    check("sleep_ms(50) within 50..60ms", slept >= 50 and slept < 60)
+    print(failed == 0 and "all passed" or (failed .. " failed"))
+    os.exit(failed == 0 and 0 or 1)
+end)
+
+evloop.run()